@@ -0,0 +1,151 @@
+#ifndef ASTCACHE_HPP
+#define ASTCACHE_HPP
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/FileSystemOptions.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/PCHContainerOperations.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+using namespace clang;
+
+//解释器的版本，语法树的使用方式改变时修改它，使旧的缓存失效
+static const char *const kInterpreterVersion = "cinterpreter-1";
+
+/* 语法树缓存：把解析好的语法树用clang的AST文件格式保存在缓存目录中，
+ * 源程序没有改变时直接加载，跳过词法、语法和语义分析。
+ * 缓存项以源程序、当前目录(决定了头文件的查找位置)、解释器和clang的版本的散列值命名：
+ *   <key>.ast    序列化的语法树
+ *   <key>.deps   包含的头文件及其内容的散列值，任何一个头文件改变，缓存项都作废
+ */
+class ASTCache {
+public:
+    explicit ASTCache(const std::string &dir)
+    : mDir(dir), mPCHOps(std::make_shared<PCHContainerOperations>()) {
+        llvm::sys::fs::create_directories(mDir);
+    }
+
+    //加载源程序对应的语法树，没有缓存或者缓存已经过期时返回nullptr
+    std::unique_ptr<ASTUnit> load(const std::string &source) {
+        std::string entry = entryPath(source);
+        if (!llvm::sys::fs::exists(entry + ".ast") || !depsUpToDate(entry + ".deps"))
+            return nullptr;
+
+        //缓存过期时clang会报告头文件已修改，这时只需重新解析，不必输出这些诊断
+        IntrusiveRefCntPtr<DiagnosticsEngine> diags =
+                CompilerInstance::createDiagnostics(new DiagnosticOptions(), new IgnoringDiagConsumer());
+        return ASTUnit::LoadFromASTFile(entry + ".ast", mPCHOps->getRawReader(),
+                                        ASTUnit::LoadEverything, diags, FileSystemOptions());
+    }
+
+    //保存语法树，有编译错误的语法树不保存，返回是否保存成功
+    bool save(ASTUnit &unit, const std::string &source) {
+        if (unit.getDiagnostics().hasErrorOccurred())
+            return false;
+        std::string entry = entryPath(source);
+        if (unit.Save(entry + ".ast"))     //Save失败时返回true
+            return false;
+
+        //记录语法树依赖的头文件，主文件来自内存，已经包含在缓存项的名字中
+        std::string deps;
+        SourceManager &sm = unit.getSourceManager();
+        for (auto it = sm.fileinfo_begin(), e = sm.fileinfo_end(); it != e; ++it) {
+            if (it->second->BufferOverridden)
+                continue;
+            llvm::SmallString<256> path(it->first->getName());
+            llvm::sys::fs::make_absolute(path);
+            std::string hash;
+            if (!hashFile(path.str(), hash))
+                return false;
+            deps += hash + " " + path.str().str() + "\n";
+        }
+        return writeAtomically(entry + ".deps", deps);
+    }
+
+    //PCH的读取器，加载的语法树在整个生命期内都要用到它
+    std::shared_ptr<PCHContainerOperations> getPCHContainerOps() {
+        return mPCHOps;
+    }
+
+private:
+    static std::string md5(llvm::ArrayRef<llvm::StringRef> parts) {
+        llvm::MD5 hash;
+        for (llvm::StringRef part : parts) {
+            hash.update(part);
+            hash.update(llvm::StringRef("\0", 1));   //分隔各部分，避免拼接后相同
+        }
+        llvm::MD5::MD5Result result;
+        hash.final(result);
+        llvm::SmallString<32> hex;
+        llvm::MD5::stringifyResult(result, hex);
+        return hex.str();
+    }
+
+    static bool hashFile(llvm::StringRef path, std::string &hash) {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = llvm::MemoryBuffer::getFile(path);
+        if (!buffer)
+            return false;
+        hash = md5((*buffer)->getBuffer());
+        return true;
+    }
+
+    std::string entryPath(const std::string &source) {
+        llvm::SmallString<256> cwd;
+        llvm::sys::fs::current_path(cwd);
+        std::string version = getClangFullVersion();
+        llvm::StringRef parts[] = { kInterpreterVersion, version, cwd.str(), source };
+        llvm::SmallString<256> path(mDir);
+        llvm::sys::path::append(path, md5(parts));
+        return path.str();
+    }
+
+    //逐个检查依赖的头文件的内容是否改变
+    static bool depsUpToDate(const std::string &file) {
+        std::ifstream deps(file);
+        if (!deps)
+            return false;
+        std::string hash, path;
+        while (deps >> hash && std::getline(deps >> std::ws, path)) {
+            std::string current;
+            if (!hashFile(path, current) || current != hash)
+                return false;
+        }
+        return deps.eof();
+    }
+
+    //先写临时文件再改名，并发运行的解释器不会读到写了一半的文件
+    static bool writeAtomically(const std::string &file, const std::string &content) {
+        int fd;
+        llvm::SmallString<256> temp;
+        if (llvm::sys::fs::createUniqueFile(file + "-%%%%%%%%", fd, temp))
+            return false;
+        {
+            llvm::raw_fd_ostream os(fd, true);
+            os << content;
+            if (os.has_error()) {
+                os.clear_error();
+                llvm::sys::fs::remove(temp);
+                return false;
+            }
+        }
+        return !llvm::sys::fs::rename(temp, file);
+    }
+
+    std::string mDir;
+    std::shared_ptr<PCHContainerOperations> mPCHOps;
+};
+
+#endif  // ~ASTCACHE_HPP
@@ -0,0 +1,229 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/PCHContainerOperations.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "io.hpp"
+#include "json.hpp"
+
+using namespace clang;
+
+//解析源程序，诊断不输出而是收集到errors中，无法得到语法树时返回nullptr
+static std::unique_ptr<ASTUnit> parseSource(const std::string &source,
+                                            std::shared_ptr<PCHContainerOperations> pch_ops,
+                                            std::string &errors) {
+    const char *args[] = { "clang-tool", "-fsyntax-only", "input.cc" };
+    ASTUnit::RemappedFile file("input.cc", llvm::MemoryBuffer::getMemBufferCopy(source, "input.cc").release());
+    IntrusiveRefCntPtr<DiagnosticsEngine> diags =
+            CompilerInstance::createDiagnostics(new DiagnosticOptions());
+    std::unique_ptr<ASTUnit> unit(ASTUnit::LoadFromCommandLine(args, args + sizeof(args) / sizeof(args[0]),
+                                                               pch_ops, diags, "", false, true, file));
+    if (!unit) {
+        errors = "cannot parse the program\n";
+        return nullptr;
+    }
+
+    for (auto it = unit->stored_diag_begin(), e = unit->stored_diag_end(); it != e; ++it) {
+        if (it->getLevel() < DiagnosticsEngine::Error)
+            continue;
+        const FullSourceLoc &loc = it->getLocation();
+        if (loc.isValid())
+            errors += std::to_string(loc.getSpellingLineNumber()) + ":" +
+                      std::to_string(loc.getSpellingColumnNumber()) + ": ";
+        errors += "error: " + it->getMessage().str() + "\n";
+    }
+    //与命令行方式相同，只有可恢复的编译错误时仍然执行，错误作为诊断信息保留
+    return unit;
+}
+
+/* 批量执行：清单中每一行是一个作业，格式为“程序 [输入文件]”，#之后为注释，路径相对于当前目录。
+ * 所有作业分给与CPU核数相同的工作线程执行，每个作业有自己的Environment和堆。
+ * 同一个程序只解析一次，它的语法树由使用它的所有作业只读共享
+ */
+class BatchRunner {
+public:
+    //在语法树上执行程序，返回退出状态，解释器的提示信息写到err中
+    typedef std::function<int(ASTUnit &unit, ProgramIO &io, llvm::raw_ostream &err)> Runner;
+    //解析成功后对语法树的处理，每个程序调用一次，在语法树被作业共享之前
+    typedef std::function<void(ASTUnit &unit)> Preparer;
+
+    BatchRunner(Runner runner, Preparer preparer, unsigned workers)
+    : mRunner(runner), mPreparer(preparer), mWorkers(workers ? workers : defaultWorkers()), mPrograms(), mJobs(),
+      mPCHOps(std::make_shared<PCHContainerOperations>()), mTotalMillis(0) {}
+
+    //读入清单，出错时返回false并设置error
+    bool loadManifest(const std::string &path, std::string &error) {
+        std::ifstream manifest(path);
+        if (!manifest) {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        std::map<std::string, size_t> program_index;
+        std::string line;
+        while (std::getline(manifest, line)) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream fields(line);
+            Job job;
+            if (!(fields >> job.program))
+                continue;
+            fields >> job.input;
+
+            auto it = program_index.find(job.program);
+            if (it == program_index.end()) {
+                it = program_index.insert(std::make_pair(job.program, mPrograms.size())).first;
+                mPrograms.push_back(Program());
+                mPrograms.back().path = job.program;
+            }
+            job.programIndex = it->second;
+            mJobs.push_back(job);
+        }
+        return true;
+    }
+
+    //先并行解析所有程序，再并行执行所有作业
+    void run() {
+        auto start = std::chrono::steady_clock::now();
+        parallelFor(mPrograms.size(), [this](size_t i) { parse(mPrograms[i]); });
+        parallelFor(mJobs.size(), [this](size_t i) { execute(mJobs[i]); });
+        mTotalMillis = millisSince(start);
+    }
+
+    //以JSON格式输出每个作业的结果
+    void writeResults(llvm::raw_ostream &os) {
+        os << "{\n  \"workers\": " << mWorkers << ",\n  \"total_ms\": " << mTotalMillis
+           << ",\n  \"jobs\": [";
+        for (size_t i = 0; i < mJobs.size(); ++i) {
+            const Job &job = mJobs[i];
+            const Program &program = mPrograms[job.programIndex];
+            os << (i ? ",\n" : "\n")
+               << "    {\"program\": " << jsonString(job.program)
+               << ", \"input\": " << jsonString(job.input)
+               << ", \"status\": " << job.status
+               << ", \"parse_ms\": " << program.parseMillis
+               << ", \"run_ms\": " << job.runMillis
+               << ", \"output\": " << jsonString(job.output)
+               << ", \"error\": " << jsonString(job.error) << "}";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+private:
+    struct Program {
+        std::string path;
+        std::unique_ptr<ASTUnit> unit;  //解析失败时为空
+        std::string error;
+        double parseMillis;
+
+        Program() : path(), unit(), error(), parseMillis(0) {}
+    };
+
+    struct Job {
+        std::string program;
+        std::string input;      //输入文件，为空或-时没有输入
+        size_t programIndex;
+        int status;
+        std::string output;
+        std::string error;
+        double runMillis;
+
+        Job() : program(), input(), programIndex(0), status(0), output(), error(), runMillis(0) {}
+    };
+
+    static unsigned defaultWorkers() {
+        unsigned cores = std::thread::hardware_concurrency();
+        return cores ? cores : 1;
+    }
+
+    static double millisSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static bool readFile(const std::string &path, std::string &content) {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+        content.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+        return true;
+    }
+
+    //在工作线程上对0到n-1调用task，每个线程从共享的计数器上领取下一个编号
+    void parallelFor(size_t n, const std::function<void(size_t)> &task) {
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        unsigned count = std::min<size_t>(mWorkers, n);
+        for (unsigned i = 0; i < count; ++i) {
+            threads.emplace_back([&next, n, &task]() {
+                for (size_t index = next++; index < n; index = next++)
+                    task(index);
+            });
+        }
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    void parse(Program &program) {
+        auto start = std::chrono::steady_clock::now();
+        std::string source;
+        if (!readFile(program.path, source))
+            program.error = "cannot open " + program.path;
+        else
+            program.unit = parseSource(source, mPCHOps, program.error);
+        if (program.unit && mPreparer)
+            mPreparer(*program.unit);
+        program.parseMillis = millisSince(start);
+    }
+
+    void execute(Job &job) {
+        Program &program = mPrograms[job.programIndex];
+        if (!program.unit) {
+            job.status = 1;
+            job.error = program.error;
+            return ;
+        }
+        std::string input;
+        if (!job.input.empty() && job.input != "-" && !readFile(job.input, input)) {
+            job.status = 1;
+            job.error = "cannot open " + job.input;
+            return ;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        StringIO io(input);
+        //先是解析时的诊断，再是执行时的提示
+        job.error = program.error;
+        llvm::raw_string_ostream err(job.error);
+        job.status = mRunner(*program.unit, io, err);
+        err.flush();
+        job.output = io.output();
+        job.runMillis = millisSince(start);
+    }
+
+    Runner mRunner;
+    Preparer mPreparer;
+    unsigned mWorkers;
+    std::vector<Program> mPrograms;
+    std::vector<Job> mJobs;
+    std::shared_ptr<PCHContainerOperations> mPCHOps;
+    double mTotalMillis;
+};
+
+#endif  // ~BATCH_HPP
@@ -0,0 +1,30 @@
+#include "sysfun.h"
+
+/* 堆的分配和释放：同时保留一批大小不同的块，按伪随机顺序替换 */
+int *blocks[64];
+int sizes[64];
+
+int main() {
+    int seed = 7;
+    int sum = 0;
+    int round, k, i;
+    for (k = 0; k < 64; k++) {
+        sizes[k] = 1;
+        blocks[k] = (int *)malloc(sizeof(int));
+        blocks[k][0] = k;
+    }
+    for (round = 0; round < 20000; round++) {
+        seed = (seed * 75 + 74) % 65537;
+        k = seed % 64;
+        sum = (sum + blocks[k][sizes[k] - 1]) % 1000003;
+        free(blocks[k]);
+        sizes[k] = seed % 32 + 1;
+        blocks[k] = (int *)malloc(sizes[k] * sizeof(int));
+        for (i = 0; i < sizes[k]; i++)
+            blocks[k][i] = round + i;
+    }
+    for (k = 0; k < 64; k++)
+        free(blocks[k]);
+    print(sum);
+    return 0;
+}
@@ -0,0 +1,13 @@
+#include "sysfun.h"
+
+/* 递归调用：函数调用、参数传递和返回值 */
+int fib(int n) {
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main() {
+    print(fib(24));
+    return 0;
+}
@@ -0,0 +1,14 @@
+#include "sysfun.h"
+
+/* 嵌套循环和整数运算，没有函数调用 */
+int main() {
+    int sum = 0;
+    int i, j;
+    for (i = 0; i < 600; i++) {
+        for (j = 0; j < 600; j++) {
+            sum = (sum + i * j + i % (j + 1)) % 1000003;
+        }
+    }
+    print(sum);
+    return 0;
+}
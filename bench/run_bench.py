@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""解释器性能测试：在每种执行方式下运行bench/中的程序，检查输出并与基准结果比较。
+
+每个程序用 cinterpreter --stats=FILE 执行若干次，取墙钟时间的中位数，
+同时记录每秒执行的节点数或指令数、峰值内存和堆单元数。
+指定 --baseline 时与之前保存的结果比较，变慢超过阈值或者输出错误时以1退出。
+指定 --against 时用另一个可执行文件(例如父提交构建的)交替执行同样的程序，报告加速比。
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+ROOT_DIR = os.path.dirname(BENCH_DIR)
+
+MODES = {
+    "ast": [],
+    "bytecode": ["--bytecode"],
+    "jit": ["--jit"],
+}
+
+
+def workloads():
+    return sorted(name[:-2] for name in os.listdir(BENCH_DIR) if name.endswith(".c"))
+
+
+def run_once(interpreter, flags, source):
+    """执行一次，返回(墙钟毫秒, 程序输出, 退出状态, 统计)"""
+    with tempfile.NamedTemporaryFile(suffix=".json", delete=False) as stats_file:
+        stats_path = stats_file.name
+    try:
+        command = [interpreter, "--fast-io", "--stats=" + stats_path] + flags + [source]
+        start = time.perf_counter()
+        proc = subprocess.run(command, cwd=ROOT_DIR, stdin=subprocess.DEVNULL,
+                              stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        wall_ms = (time.perf_counter() - start) * 1000
+        try:
+            with open(stats_path) as f:
+                stats = json.load(f)
+        except (OSError, ValueError):
+            stats = {}
+        return wall_ms, proc.stderr.decode(errors="replace"), proc.returncode, stats
+    finally:
+        os.unlink(stats_path)
+
+
+def run_workload(interpreter, mode, name, repeat):
+    source = os.path.join(BENCH_DIR, name + ".c")
+    with open(os.path.join(BENCH_DIR, "expected", name + ".out")) as f:
+        expected = f.read()
+
+    times = []
+    result = {"workload": name, "mode": mode, "correct": True}
+    for _ in range(repeat):
+        wall_ms, output, status, stats = run_once(interpreter, MODES[mode], source)
+        times.append(wall_ms)
+        if status != 0 or output != expected:
+            result["correct"] = False
+            result["output"] = output
+            result["status"] = status
+        result["stats"] = stats
+
+    stats = result.pop("stats")
+    result["wall_ms"] = statistics.median(times)
+    result["run_ms"] = stats.get("run_ms", 0)
+    result["ops_per_sec"] = stats.get("ops_per_sec", 0)
+    result["peak_rss_kb"] = stats.get("peak_rss_kb", 0)
+    result["heap_peak_cells"] = stats.get("heap_peak_cells", 0)
+    result["executed_mode"] = stats.get("mode", "")
+    return result
+
+
+def compare(results, baseline, threshold):
+    """返回变慢超过threshold的结果"""
+    previous = {(r["workload"], r["mode"]): r for r in baseline.get("results", [])}
+    regressions = []
+    for result in results:
+        old = previous.get((result["workload"], result["mode"]))
+        if not old or not old.get("wall_ms"):
+            continue
+        ratio = result["wall_ms"] / old["wall_ms"]
+        result["baseline_wall_ms"] = old["wall_ms"]
+        result["ratio"] = round(ratio, 3)
+        if ratio > 1 + threshold:
+            regressions.append(result)
+    return regressions
+
+
+def speedups(results, others):
+    """把另一个解释器的中位数时间和加速比记入results"""
+    for result, other in zip(results, others):
+        result["against_wall_ms"] = other["wall_ms"]
+        result["speedup"] = round(other["wall_ms"] / result["wall_ms"], 3) if result["wall_ms"] else 0
+        if not other["correct"]:
+            result["against_correct"] = False
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--interpreter", default=os.path.join(ROOT_DIR, "cinterpreter"),
+                        help="cinterpreter可执行文件")
+    parser.add_argument("--repeat", type=int, default=3, help="每个程序执行的次数")
+    parser.add_argument("--modes", default="ast,bytecode", help="逗号分隔的执行方式：" + ",".join(MODES))
+    parser.add_argument("--workloads", default="", help="逗号分隔的程序名，默认为全部")
+    parser.add_argument("--baseline", default=os.path.join(BENCH_DIR, "baseline.json"),
+                        help="基准结果，不存在时不比较")
+    parser.add_argument("--threshold", type=float, default=0.10, help="允许变慢的比例")
+    parser.add_argument("--output", default="", help="结果文件，默认输出到标准输出")
+    parser.add_argument("--update-baseline", action="store_true", help="把本次结果保存为基准")
+    parser.add_argument("--against", default="", help="与之比较的另一个cinterpreter，例如改动之前构建的")
+    args = parser.parse_args()
+
+    modes = [mode for mode in args.modes.split(",") if mode]
+    for mode in modes:
+        if mode not in MODES:
+            parser.error("unknown mode " + mode)
+    names = [name for name in args.workloads.split(",") if name] or workloads()
+
+    results = []
+    others = []
+    for name in names:
+        for mode in modes:
+            result = run_workload(args.interpreter, mode, name, args.repeat)
+            results.append(result)
+            print("%-8s %-9s %10.1f ms %14.0f ops/s %8d KB %s" % (
+                name, mode, result["wall_ms"], result["ops_per_sec"], result["peak_rss_kb"],
+                "" if result["correct"] else "WRONG OUTPUT"), file=sys.stderr)
+            if args.against:
+                other = run_workload(args.against, mode, name, args.repeat)
+                others.append(other)
+                print("%-8s %-9s %10.1f ms before, %.2fx" % (
+                    name, mode, other["wall_ms"], other["wall_ms"] / result["wall_ms"] if result["wall_ms"] else 0),
+                    file=sys.stderr)
+    if args.against:
+        speedups(results, others)
+
+    regressions = []
+    if os.path.exists(args.baseline) and not args.update_baseline:
+        with open(args.baseline) as f:
+            regressions = compare(results, json.load(f), args.threshold)
+        for result in regressions:
+            print("regression: %s %s %.1f ms -> %.1f ms" % (
+                result["workload"], result["mode"], result["baseline_wall_ms"], result["wall_ms"]),
+                file=sys.stderr)
+
+    summary = {"repeat": args.repeat, "results": results}
+    if args.against:
+        summary["against"] = args.against
+    report = json.dumps(summary, indent=2) + "\n"
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(report)
+    else:
+        sys.stdout.write(report)
+    if args.update_baseline:
+        with open(args.baseline, "w") as f:
+            f.write(report)
+
+    wrong = [result for result in results if not result["correct"]]
+    return 1 if wrong or regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,24 @@
+#include "sysfun.h"
+
+/* 埃拉托斯特尼筛法：全局数组的读写 */
+int flags[100000];
+
+int main() {
+    int n = 100000;
+    int count = 0;
+    int i, j;
+    for (i = 2; i < n; i++)
+        flags[i] = 1;
+    for (i = 2; i * i < n; i++) {
+        if (flags[i]) {
+            for (j = i * i; j < n; j = j + i)
+                flags[j] = 0;
+        }
+    }
+    for (i = 2; i < n; i++) {
+        if (flags[i])
+            count++;
+    }
+    print(count);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include "sysfun.h"
+
+/* 指针参数和被取地址的局部变量：冒泡排序伪随机数 */
+void swap(int *a, int *b) {
+    int t = *a;
+    *a = *b;
+    *b = t;
+}
+
+int main() {
+    int n = 400;
+    int *data = (int *)malloc(n * sizeof(int));
+    int seed = 1;
+    int i, j;
+    for (i = 0; i < n; i++) {
+        seed = (seed * 75 + 74) % 65537;
+        data[i] = seed;
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j + 1 < n - i; j++) {
+            if (data[j] > data[j + 1])
+                swap(data + j, &data[j + 1]);
+        }
+    }
+    int checksum = 0;
+    for (i = 0; i < n; i++)
+        checksum = (checksum * 31 + data[i]) % 1000003;
+    print(data[0]);
+    print(data[n - 1]);
+    print(checksum);
+    free(data);
+    return 0;
+}
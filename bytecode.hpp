@@ -0,0 +1,1381 @@
+#ifndef BYTECODE_HPP
+#define BYTECODE_HPP
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+#include "environment.hpp"
+
+using namespace clang;
+
+/* 寄存器式字节码。每个函数体在执行前只编译一次：参数和局部变量占据固定的寄存器，
+ * 表达式的中间结果放在临时寄存器中，解释循环只需按下标访问寄存器，
+ * 不再重复遍历语法树，也不再查找std::map
+ */
+enum OpCode {
+    OP_CONST,       // a = consts[b]
+    OP_MOV,         // a = b
+    OP_LOADG,       // a = heap[b]，b为全局变量的地址
+    OP_STOREG,      // heap[a] = b，a为全局变量的地址
+    OP_LOAD,        // a = heap[b]
+    OP_STORE,       // heap[a] = b
+    OP_LOADX,       // a = heap[b + c]，用于a[i]
+    OP_STOREX,      // heap[a + b] = c
+    OP_ADD,         // a = (int)(b + c)，int运算的结果都按int回绕
+    OP_ADDI,        // a = (int)(b + c)，c为立即数
+    OP_SUB,         // a = (int)(b - c)
+    OP_MUL,         // a = (int)b * (int)c
+    OP_DIV,         // a = (int)b / (int)c
+    OP_REM,         // a = (int)b % (int)c
+    OP_AND,         // a = b & c
+    OP_OR,          // a = b | c
+    OP_XOR,         // a = b ^ c
+    OP_SHL,         // a = (int)(b << c)
+    OP_SHR,         // a = b >> c
+    OP_LT,          // a = (int)b < (int)c，以下比较类似
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_NEG,         // a = (int)-b
+    OP_NOT,         // a = !b
+    OP_BNOT,        // a = ~b
+    OP_BOOL,        // a = b != 0
+    OP_TRUNC,       // a = (int)b
+    OP_MULL,        // a = b * c，long运算，用于long和指针，按位与、或、异或和右移与int共用
+    OP_DIVL,
+    OP_REML,
+    OP_LTL,         // a = b < c，以下long比较类似
+    OP_GTL,
+    OP_LEL,
+    OP_GEL,
+    OP_EQL,
+    OP_NEL,
+    OP_ADDL,        // a = b + c，也用于计算地址
+    OP_ADDIL,       // a = b + c，c为立即数
+    OP_SUBL,
+    OP_SHLL,
+    OP_NEGL,
+    OP_ADDF,        // a = b + c，double运算，寄存器中是double的位模式
+    OP_SUBF,
+    OP_MULF,
+    OP_DIVF,
+    OP_LTF,         // a = b < c，以下double比较类似
+    OP_GTF,
+    OP_LEF,
+    OP_GEF,
+    OP_EQF,
+    OP_NEF,
+    OP_NEGF,        // a = -b
+    OP_I2F,         // a = (double)b
+    OP_F2I,         // a = (long)b
+    OP_BOOLF,       // a = b != 0.0
+    OP_JMP,         // pc = a
+    OP_JZ,          // if (!a) pc = b
+    OP_JNZ,         // if (a) pc = b
+    OP_JLT,         // if ((int)a < (int)b) pc = c，比较和条件跳转合为一条指令，以下类似
+    OP_JGT,
+    OP_JLE,
+    OP_JGE,
+    OP_JEQ,
+    OP_JNE,
+    OP_JLTI,        // if ((int)a < b) pc = c，b为立即数，以下类似
+    OP_JGTI,
+    OP_JLEI,
+    OP_JGEI,
+    OP_JEQI,
+    OP_JNEI,
+    OP_TICK,        // 循环回边，执行预算记一步、启用JIT时计入当前函数，a为循环语句在sites中的下标，只在设置了预算或启用JIT时生成
+    OP_ALLOCA,      // a = 在栈内存中分配b个单元，用于局部数组和被取地址的局部变量，函数返回时释放
+    OP_ZERO,        // a[0..b) = 0，局部数组的声明处清零
+    OP_CALL,        // a = functions[b](c, c + 1, ...)
+    OP_TAILCALL,    // 同OP_CALL，但复用当前栈帧，后面总是紧跟OP_RET a
+    OP_NATIVE,      // a = natives[b](c, c + 1, ...)，调用没有定义的函数绑定的本地实现
+    OP_RET,         // return a
+    OP_RETV,        // return
+    OP_GET,         // a = get()
+    OP_PRINT,       // print(a)
+    OP_MALLOC,      // a = malloc(b)，c为调用位置在sites中的下标
+    OP_FREE         // free(a)
+};
+
+struct Instruction {
+    OpCode op;
+    int a;
+    int b;
+    int c;
+};
+
+//编译后的函数
+struct CompiledFunction {
+    FunctionDecl *decl;
+    std::vector<Instruction> code;
+    std::vector<long> consts;
+    unsigned numParams;
+    unsigned numRegs;
+};
+
+//整个程序编译后的结果
+struct BytecodeModule {
+    std::vector<CompiledFunction> functions;
+    //函数声明(规范声明)到函数下标的映射
+    llvm::DenseMap<const FunctionDecl *, unsigned> functionIndex;
+    //全局变量(规范声明)到其所在内存地址的映射
+    llvm::DenseMap<const VarDecl *, long> globals;
+    //指令引用的语法树位置：malloc的调用用于堆的统计，循环语句用于报告超出执行预算的位置
+    std::vector<const Stmt *> sites;
+};
+
+class BytecodeCompiler {
+public:
+    BytecodeCompiler(const ASTContext &context, Environment &env, BytecodeModule &module)
+    : mContext(context), mEnv(env), mModule(module), mFunc(nullptr),
+      mFirstTemp(0), mNextTemp(0), mTailCalls(false), mLabelFence(0), mLoops() {}
+
+    //编译整个翻译单元，遇到不支持的语法时返回false，错误信息由getError取得
+    bool compile(TranslationUnitDecl *unit) {
+        std::lock_guard<std::mutex> lock(astContextMutex());
+        //先为全局变量分配内存，初始值由Environment::init计算
+        for (auto i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i) {
+            if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
+                const VarDecl *canon = vdecl->getCanonicalDecl();
+                if (mModule.globals.count(canon))
+                    continue;
+                //被取地址的全局变量已经在内存中，槽位中是它的地址，直接使用这个单元
+                if (mEnv.slotOf(vdecl).addressable) {
+                    mModule.globals[canon] = mEnv.getGlobalVal(vdecl);
+                    continue;
+                }
+                long addr = mEnv.getHeap().Malloc(1);
+                mEnv.getHeap().Update(addr, mEnv.getGlobalVal(vdecl));
+                mModule.globals[canon] = addr;
+            }
+        }
+
+        //再给所有有函数体的函数编号，这样递归调用和先调用后定义的函数都能找到
+        for (auto i = unit->decls_begin(), e = unit->decls_end(); i != e; ++i) {
+            FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i);
+            if (!fdecl || !fdecl->doesThisDeclarationHaveABody())
+                continue;
+            CompiledFunction func;
+            func.decl = fdecl;
+            func.numParams = fdecl->getNumParams();
+            func.numRegs = 0;
+            mModule.functionIndex[fdecl->getCanonicalDecl()] = mModule.functions.size();
+            mModule.functions.push_back(func);
+        }
+
+        for (auto &func : mModule.functions)
+            if (!compileFunction(func))
+                return false;
+        return true;
+    }
+
+    const std::string &getError() const {
+        return mError;
+    }
+
+private:
+    //局部变量所在的寄存器，boxed表示寄存器里存放的是变量在内存中的地址
+    struct LocalVar {
+        int reg;
+        bool boxed;
+    };
+
+    //左值：寄存器中的局部变量、全局变量、内存地址或者数组元素
+    struct LValue {
+        enum Kind { REG, GLOBAL, MEMORY, INDEXED } kind;
+        long where;     //寄存器编号、全局变量地址或存放地址的寄存器编号，INDEXED时为存放首地址的寄存器
+        long offset;    //INDEXED时为存放下标的寄存器
+    };
+
+    //正在编译的循环中break和continue的跳转指令，循环结束时才知道它们的目标
+    struct LoopJumps {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    bool compileFunction(CompiledFunction &func) {
+        mFunc = &func;
+        mLocals.clear();
+        mLoops.clear();
+        mError.clear();
+        mLabelFence = 0;
+
+        FunctionDecl *fdecl = func.decl;
+        Stmt *body = fdecl->getBody();
+
+        llvm::DenseSet<const VarDecl *> addr_taken;
+        AddrTakenFinder(addr_taken).TraverseStmt(body);
+        std::vector<VarDecl *> vars;
+        LocalVarFinder(vars).TraverseStmt(body);
+
+        //参数占据前numParams个寄存器，随后是局部变量，再往后是临时寄存器
+        int reg = 0;
+        for (ParmVarDecl *param : fdecl->parameters()) {
+            LocalVar local = { reg++, addr_taken.count(param) != 0 };
+            mLocals[param] = local;
+        }
+        for (VarDecl *var : vars) {
+            LocalVar local = { reg++, addr_taken.count(var) != 0 };
+            mLocals[var] = local;
+        }
+        mFirstTemp = mNextTemp = reg;
+        func.numRegs = reg;
+
+        //被取地址的变量放到内存中，参数要先把传入的值搬进去
+        for (ParmVarDecl *param : fdecl->parameters()) {
+            LocalVar &local = mLocals[param];
+            if (!local.boxed)
+                continue;
+            int tmp = newTemp();
+            emit(OP_ALLOCA, tmp, 1);
+            emit(OP_STORE, tmp, local.reg);
+            emit(OP_MOV, local.reg, tmp);
+        }
+        /* 局部数组也在入口处一次分配，循环体内的数组每轮只在声明处清零，函数返回时一起释放。
+         * 有栈内存的函数中实参可能指向这些内存，返回处的调用不能作为尾调用
+         */
+        mTailCalls = true;
+        for (VarDecl *var : vars) {
+            LocalVar &local = mLocals[var];
+            if (local.boxed)
+                emit(OP_ALLOCA, local.reg, 1);
+            else if (const ConstantArrayType *array = mContext.getAsConstantArrayType(var->getType()))
+                emit(OP_ALLOCA, local.reg, array->getSize().getZExtValue());
+            else
+                continue;
+            mTailCalls = false;
+        }
+        for (ParmVarDecl *param : fdecl->parameters())
+            if (mLocals[param].boxed)
+                mTailCalls = false;
+
+        if (!compileStmt(body))
+            return false;
+        emit(OP_RETV);
+        return true;
+    }
+
+    /* 语句 */
+
+    bool compileStmt(Stmt *stmt) {
+        if (!stmt)
+            return true;
+        //每条语句结束后临时寄存器就可以重用了
+        mNextTemp = mFirstTemp;
+
+        if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt)) {
+            for (Stmt *child : compound->body())
+                if (!compileStmt(child))
+                    return false;
+            return true;
+        }
+        if (isa<NullStmt>(stmt))
+            return true;
+        if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt))
+            return compileDecl(declstmt);
+        if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt))
+            return compileIf(ifstmt);
+        if (WhileStmt *whilestmt = dyn_cast<WhileStmt>(stmt))
+            return compileWhile(whilestmt);
+        if (DoStmt *dostmt = dyn_cast<DoStmt>(stmt))
+            return compileDo(dostmt);
+        if (ForStmt *forstmt = dyn_cast<ForStmt>(stmt))
+            return compileFor(forstmt);
+        if (ReturnStmt *retstmt = dyn_cast<ReturnStmt>(stmt)) {
+            if (Expr *ret_expr = retstmt->getRetValue()) {
+                if (CallExpr *call = dyn_cast<CallExpr>(ret_expr->IgnoreParens())) {
+                    int val = compileCall(call, mTailCalls);
+                    if (val < 0)
+                        return false;
+                    emit(OP_RET, val);
+                    return true;
+                }
+                int val = compileExpr(ret_expr);
+                if (val < 0)
+                    return false;
+                emit(OP_RET, val);
+            } else {
+                emit(OP_RETV);
+            }
+            return true;
+        }
+        if (isa<BreakStmt>(stmt) || isa<ContinueStmt>(stmt)) {
+            if (mLoops.empty())
+                return unsupported(stmt);
+            LoopJumps &jumps = mLoops.back();
+            (isa<BreakStmt>(stmt) ? jumps.breaks : jumps.continues).push_back(emitJump(OP_JMP));
+            return true;
+        }
+        if (Expr *expr = dyn_cast<Expr>(stmt))
+            return compileExpr(expr) >= 0;
+
+        return unsupported(stmt);
+    }
+
+    bool compileDecl(DeclStmt *declstmt) {
+        for (Decl *decl : declstmt->decls()) {
+            VarDecl *vardecl = dyn_cast<VarDecl>(decl);
+            if (!vardecl)
+                continue;
+            //函数内的static和extern变量不在寄存器中，也不在globals里，交给树遍历模式执行
+            if (!vardecl->hasLocalStorage())
+                return unsupported(declstmt);
+            LocalVar local = mLocals.lookup(vardecl);
+
+            if (const ConstantArrayType *array = mContext.getAsConstantArrayType(vardecl->getType())) {
+                //数组的值就是首地址，内存已在入口处分配，与树遍历模式一样每次声明时清零
+                emit(OP_ZERO, local.reg, array->getSize().getZExtValue());
+                continue;
+            }
+
+            int val;
+            if (vardecl->hasInit()) {
+                val = compileExpr(vardecl->getInit());
+                if (val < 0)
+                    return false;
+            } else {
+                val = constant(0);  //未初始化的变量与树遍历模式一样初始化为0
+            }
+            LValue lval = { LValue::REG, local.reg };
+            if (local.boxed)
+                lval.kind = LValue::MEMORY;
+            store(lval, val);
+        }
+        return true;
+    }
+
+    bool compileIf(IfStmt *ifstmt) {
+        int cond = compileExpr(ifstmt->getCond());
+        if (cond < 0)
+            return false;
+        size_t to_else = emitJump(OP_JZ, cond);
+        if (!compileStmt(ifstmt->getThen()))
+            return false;
+        if (Stmt *else_body = ifstmt->getElse()) {
+            size_t to_end = emitJump(OP_JMP);
+            bind(to_else);
+            if (!compileStmt(else_body))
+                return false;
+            bind(to_end);
+        } else {
+            bind(to_else);
+        }
+        return true;
+    }
+
+    bool compileWhile(WhileStmt *whilestmt) {
+        size_t head = here();
+        emitTick(whilestmt);
+        int cond = compileExpr(whilestmt->getCond());
+        if (cond < 0)
+            return false;
+        size_t to_end = emitJump(OP_JZ, cond);
+        mLoops.push_back(LoopJumps());
+        if (!compileStmt(whilestmt->getBody()))
+            return false;
+        emit(OP_JMP, head);
+        bind(to_end);
+        endLoop(head);
+        return true;
+    }
+
+    bool compileDo(DoStmt *dostmt) {
+        size_t head = here();
+        mLoops.push_back(LoopJumps());
+        if (!compileStmt(dostmt->getBody()))
+            return false;
+        mNextTemp = mFirstTemp;
+        size_t next = here();
+        emitTick(dostmt);
+        int cond = compileExpr(dostmt->getCond());
+        if (cond < 0)
+            return false;
+        emit(OP_JNZ, cond, head);
+        endLoop(next);
+        return true;
+    }
+
+    bool compileFor(ForStmt *forstmt) {
+        if (!compileStmt(forstmt->getInit()))
+            return false;
+        size_t head = here();
+        emitTick(forstmt);
+        size_t to_end = 0;
+        bool has_cond = forstmt->getCond() != nullptr;
+        if (has_cond) {
+            mNextTemp = mFirstTemp;
+            int cond = compileExpr(forstmt->getCond());
+            if (cond < 0)
+                return false;
+            to_end = emitJump(OP_JZ, cond);
+        }
+        mLoops.push_back(LoopJumps());
+        if (!compileStmt(forstmt->getBody()))
+            return false;
+        size_t next = here();
+        if (!compileStmt(forstmt->getInc()))
+            return false;
+        emit(OP_JMP, head);
+        if (has_cond)
+            bind(to_end);
+        endLoop(next);
+        return true;
+    }
+
+    //设置了执行预算或启用JIT时在循环每轮都经过的位置记一次回边，continue也不会绕过
+    void emitTick(Stmt *loop) {
+        if (!mEnv.hasBudget() && !mEnv.hasJit())
+            return ;
+        emit(OP_TICK, mModule.sites.size());
+        mModule.sites.push_back(loop);
+    }
+
+    //循环结束，continue跳到next，break跳到循环之后
+    void endLoop(size_t next) {
+        LoopJumps jumps = std::move(mLoops.back());
+        mLoops.pop_back();
+        for (size_t jump : jumps.continues)
+            bindTo(jump, next);
+        size_t end = here();
+        for (size_t jump : jumps.breaks)
+            bindTo(jump, end);
+    }
+
+    /* 表达式，返回存放结果的寄存器，出错时返回-1 */
+
+    int compileExpr(Expr *expr) {
+        expr = expr->IgnoreParens();
+        //只支持int、long、double、bool和指针，char、unsigned等类型的程序遍历语法树执行
+        if (!supportedKind(valueKind(expr->getType())))
+            return unsupported(expr), -1;
+
+        if (IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr))
+            return constant(integer->getValue().getSExtValue());
+        if (FloatingLiteral *floating = dyn_cast<FloatingLiteral>(expr))
+            return constant(Word<double>::make(floating->getValueAsApproximateDouble()));
+        if (CharacterLiteral *character = dyn_cast<CharacterLiteral>(expr))
+            return constant(character->getValue());
+        if (CXXBoolLiteralExpr *boolean = dyn_cast<CXXBoolLiteralExpr>(expr))
+            return constant(boolean->getValue());
+        if (CastExpr *castexpr = dyn_cast<CastExpr>(expr))
+            return compileCast(castexpr);
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+            if (EnumConstantDecl *enumerator = dyn_cast<EnumConstantDecl>(declref->getDecl()))
+                return constant(enumerator->getInitVal().getSExtValue());
+            LValue lval;
+            if (!lvalue(declref, lval))
+                return -1;
+            return load(lval);
+        }
+        if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+            return compileBinop(bop);
+        if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+            return compileUnaryop(uop);
+        if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(expr)) {
+            LValue lval;
+            if (!lvalue(array, lval))
+                return -1;
+            return load(lval);
+        }
+        if (UnaryExprOrTypeTraitExpr *uett = dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+            if (uett->getKind() != UETT_SizeOf)
+                return unsupported(expr), -1;
+            return constant(sizeOfType(uett->getTypeOfArgument()));
+        }
+        if (CallExpr *call = dyn_cast<CallExpr>(expr))
+            return compileCall(call);
+
+        unsupported(expr);
+        return -1;
+    }
+
+    int compileCast(CastExpr *castexpr) {
+        Expr *sub_expr = castexpr->getSubExpr();
+        switch (castexpr->getCastKind()) {
+        case CK_LValueToRValue:
+        case CK_ArrayToPointerDecay: {    //数组变量的值就是首地址
+            LValue lval;
+            if (!lvalue(sub_expr, lval))
+                return -1;
+            return load(lval);
+        }
+        default:
+            break;
+        }
+        int val = compileExpr(sub_expr);
+        if (val < 0 || !isValueCast(castexpr->getCastKind()))   //其它转换不改变值
+            return val;
+        return convert(val, valueKind(sub_expr->getType()), valueKind(castexpr->getType()));
+    }
+
+    //把寄存器val中from类型的值转换为to类型，值不变时直接返回val
+    int convert(int val, ValueKind from, ValueKind to) {
+        if (from == to)
+            return val;
+        OpCode op;
+        if (to == VK_BOOL)
+            op = from == VK_F64 ? OP_BOOLF : OP_BOOL;
+        else if (to == VK_F64)
+            op = OP_I2F;
+        else if (from == VK_F64)
+            op = OP_F2I;
+        else if (to == VK_I32)
+            op = OP_TRUNC;
+        else    //int和bool扩展为long或指针
+            return val;
+        int dst = newTemp();
+        emit(op, dst, val);
+        return dst;
+    }
+
+    static bool supportedKind(ValueKind kind) {
+        switch (kind) {
+        case VK_VOID: case VK_BOOL: case VK_I32: case VK_I64: case VK_F64: case VK_PTR:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    int compileBinop(BinaryOperator *bop) {
+        BinaryOperatorKind opcode = bop->getOpcode();
+
+        if (opcode == BO_Comma) {
+            if (compileExpr(bop->getLHS()) < 0)
+                return -1;
+            return compileExpr(bop->getRHS());
+        }
+
+        //逻辑运算短路求值
+        if (opcode == BO_LAnd || opcode == BO_LOr) {
+            int dst = newTemp();
+            int left = compileExpr(bop->getLHS());
+            if (left < 0)
+                return -1;
+            size_t to_short = emitJump(opcode == BO_LAnd ? OP_JZ : OP_JNZ, left);
+            int right = compileExpr(bop->getRHS());
+            if (right < 0)
+                return -1;
+            emit(OP_BOOL, dst, right);
+            size_t to_end = emitJump(OP_JMP);
+            bind(to_short);
+            emit(OP_CONST, dst, addConst(opcode == BO_LAnd ? 0 : 1));
+            bind(to_end);
+            return dst;
+        }
+
+        //赋值，整个表达式的值为赋值号右边的值
+        if (opcode == BO_Assign) {
+            int val = compileExpr(bop->getRHS());
+            if (val < 0)
+                return -1;
+            LValue lval;
+            if (!lvalue(bop->getLHS(), lval))
+                return -1;
+            return store(lval, val);
+        }
+
+        //复合赋值，如+=，左边的值转换为计算类型后运算，结果再转换回左边的类型
+        if (bop->isCompoundAssignmentOp()) {
+            CompoundAssignOperator *assign = cast<CompoundAssignOperator>(bop);
+            ValueKind target = valueKind(assign->getLHS()->getType());
+            ValueKind computation = valueKind(assign->getComputationLHSType());
+            OpCode op = arithOp(BinaryOperator::getOpForCompoundAssignment(opcode), computation);
+            if (op == OP_RETV || !supportedKind(computation))
+                return unsupported(bop), -1;
+            LValue lval;
+            if (!lvalue(bop->getLHS(), lval))
+                return -1;
+            int right = compileExpr(bop->getRHS());
+            if (right < 0)
+                return -1;
+            int left = convert(load(lval), target, computation);
+            int dst = newTemp();
+            emit(op, dst, left, right);
+            return store(lval, convert(dst, valueKind(assign->getComputationResultType()), target));
+        }
+
+        //按左操作数(已经过通常算术转换)的类型选择指令，整数加指针按指针计算
+        ValueKind kind = valueKind(bop->getLHS()->getType());
+        if (bop->isAdditiveOp() && bop->getType()->isPointerType())
+            kind = VK_PTR;
+
+        //整数加减一个int范围内的常量时用立即数，i = i + 1只需要一条指令
+        if ((opcode == BO_Add || opcode == BO_Sub) && kind != VK_F64) {
+            long imm;
+            Expr *other = NULL;
+            if (immediate(bop->getRHS(), imm))
+                other = bop->getLHS();
+            else if (opcode == BO_Add && immediate(bop->getLHS(), imm))
+                other = bop->getRHS();
+            if (other && llvm::isInt<32>(opcode == BO_Sub ? -imm : imm)) {
+                int val = compileExpr(other);
+                if (val < 0)
+                    return -1;
+                int dst = newTemp();
+                emit(kind == VK_I32 ? OP_ADDI : OP_ADDIL, dst, val, opcode == BO_Sub ? -imm : imm);
+                return dst;
+            }
+        }
+
+        int left = compileExpr(bop->getLHS());
+        if (left < 0)
+            return -1;
+        int right = compileExpr(bop->getRHS());
+        if (right < 0)
+            return -1;
+        OpCode op = arithOp(opcode, kind);
+        if (op == OP_RETV)
+            return unsupported(bop), -1;
+        int dst = newTemp();
+        emit(op, dst, left, right);
+        return dst;
+    }
+
+    int compileUnaryop(UnaryOperator *uop) {
+        Expr *sub_expr = uop->getSubExpr();
+        int dst;
+        switch (uop->getOpcode()) {
+        case UO_PostInc:
+        case UO_PostDec:
+        case UO_PreInc:
+        case UO_PreDec: {
+            LValue lval;
+            if (!lvalue(sub_expr, lval))
+                return -1;
+            int old = load(lval);
+            int delta = uop->isIncrementOp() ? 1 : -1;
+            ValueKind kind = valueKind(sub_expr->getType());
+            int one = kind == VK_F64 ? constant(Word<double>::make(delta)) : 0;
+            if (uop->isPrefix()) {
+                dst = newTemp();
+                emitStep(dst, old, delta, one, kind);
+                return store(lval, dst);
+            }
+            //后置运算要保存原值，变量在寄存器中时load直接返回变量本身
+            dst = newTemp();
+            emit(OP_MOV, dst, old);
+            int updated = newTemp();
+            emitStep(updated, old, delta, one, kind);
+            store(lval, updated);
+            return dst;
+        }
+        case UO_AddrOf:
+            return compileAddrOf(sub_expr);
+        case UO_Deref: {
+            LValue lval;
+            if (!lvalue(uop, lval))
+                return -1;
+            return load(lval);
+        }
+        case UO_Plus:
+            return compileExpr(sub_expr);
+        case UO_Minus:
+        case UO_LNot:
+        case UO_Not: {
+            int val = compileExpr(sub_expr);
+            if (val < 0)
+                return -1;
+            dst = newTemp();
+            ValueKind kind = valueKind(uop->getType());
+            OpCode op = uop->getOpcode() == UO_LNot ? OP_NOT :
+                        uop->getOpcode() == UO_Not ? OP_BNOT :
+                        kind == VK_F64 ? OP_NEGF : kind == VK_I32 ? OP_NEG : OP_NEGL;
+            emit(op, dst, val);
+            return dst;
+        }
+        default:
+            unsupported(uop);
+            return -1;
+        }
+    }
+
+    //自增自减，整数和指针加立即数，double加寄存器one中的常量±1.0
+    void emitStep(int dst, int old, int delta, int one, ValueKind kind) {
+        if (kind == VK_F64)
+            emit(OP_ADDF, dst, old, one);
+        else
+            emit(kind == VK_I32 ? OP_ADDI : OP_ADDIL, dst, old, delta);
+    }
+
+    int compileAddrOf(Expr *expr) {
+        expr = expr->IgnoreParens();
+        //数组名的地址就是首地址
+        if (expr->getType()->isArrayType())
+            return compileExpr(expr);
+        //&*p就是p
+        if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+            if (uop->getOpcode() == UO_Deref)
+                return compileExpr(uop->getSubExpr());
+
+        LValue lval;
+        if (!lvalue(expr, lval))
+            return -1;
+        switch (lval.kind) {
+        case LValue::GLOBAL:
+            return constant(lval.where);
+        case LValue::MEMORY:
+            return lval.where;
+        case LValue::INDEXED: {
+            int addr = newTemp();
+            emit(OP_ADDL, addr, lval.where, lval.offset);
+            return addr;
+        }
+        default:        //只有被取地址的变量会放到内存中，寄存器中的变量不可能出现在这里
+            unsupported(expr);
+            return -1;
+        }
+    }
+
+    //tail为true时调用用户函数编译为尾调用，之后必须紧跟返回结果的OP_RET
+    int compileCall(CallExpr *call, bool tail = false) {
+        FunctionDecl *callee = call->getDirectCallee();
+        if (!callee)
+            return unsupported(call), -1;
+
+        const FunctionDecl *definition = nullptr;
+        if (callee->hasBody(definition)) {
+            unsigned index = mModule.functionIndex.lookup(definition->getCanonicalDecl());
+            //参数放在连续的临时寄存器中
+            unsigned num_args = call->getNumArgs();
+            int base = mNextTemp;
+            for (unsigned i = 0; i < num_args; ++i)
+                newTemp();
+            for (unsigned i = 0; i < num_args; ++i) {
+                int val = compileExpr(call->getArg(i));
+                if (val < 0)
+                    return -1;
+                move(base + i, val);
+            }
+            int dst = newTemp();
+            emit(tail ? OP_TAILCALL : OP_CALL, dst, index, base);
+            return dst;
+        }
+
+        //没有定义的函数调用本地实现，get、print、malloc和free有专门的指令
+        int native = mEnv.nativeIndex(callee);
+        if (native < 0)
+            return unsupported(call), -1;
+        BuiltinFunction builtin = mEnv.getNative(native).builtin;
+        if (builtin == &Environment::builtinGet) {
+            int dst = newTemp();
+            emit(OP_GET, dst);
+            return dst;
+        }
+        if (builtin == &Environment::builtinPrint || builtin == &Environment::builtinMalloc ||
+                builtin == &Environment::builtinFree) {
+            int val = compileExpr(call->getArg(0));
+            if (val < 0)
+                return -1;
+            if (builtin == &Environment::builtinPrint) {
+                emit(OP_PRINT, val);
+                return val;
+            }
+            if (builtin == &Environment::builtinFree) {
+                emit(OP_FREE, val);
+                return val;
+            }
+            int dst = newTemp();
+            emit(OP_MALLOC, dst, val, mModule.sites.size());
+            mModule.sites.push_back(call);
+            return dst;
+        }
+
+        //其它本地函数的实参和用户函数一样放在连续的临时寄存器中
+        unsigned num_args = call->getNumArgs();
+        int base = mNextTemp;
+        for (unsigned i = 0; i < num_args; ++i)
+            newTemp();
+        for (unsigned i = 0; i < num_args; ++i) {
+            int val = compileExpr(call->getArg(i));
+            if (val < 0)
+                return -1;
+            move(base + i, val);
+        }
+        int dst = newTemp();
+        emit(OP_NATIVE, dst, native, base);
+        return dst;
+    }
+
+    /* 左值 */
+
+    bool lvalue(Expr *expr, LValue &lval) {
+        expr = expr->IgnoreParens();
+
+        if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+            VarDecl *var = dyn_cast<VarDecl>(declref->getDecl());
+            if (!var)
+                return unsupported(expr);
+            if (var->hasLocalStorage()) {
+                LocalVar local = mLocals.lookup(var);
+                lval.kind = local.boxed ? LValue::MEMORY : LValue::REG;
+                lval.where = local.reg;
+            } else {
+                auto global = mModule.globals.find(var->getCanonicalDecl());
+                if (global == mModule.globals.end())
+                    return unsupported(expr);
+                lval.kind = LValue::GLOBAL;
+                lval.where = global->second;
+            }
+            return true;
+        }
+        if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+            if (uop->getOpcode() != UO_Deref)
+                return unsupported(expr);
+            int addr = compileExpr(uop->getSubExpr());
+            if (addr < 0)
+                return false;
+            lval.kind = LValue::MEMORY;
+            lval.where = addr;
+            return true;
+        }
+        if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(expr)) {
+            int base = compileExpr(array->getBase());
+            if (base < 0)
+                return false;
+            int offset = compileExpr(array->getIdx());
+            if (offset < 0)
+                return false;
+            lval.kind = LValue::INDEXED;
+            lval.where = base;
+            lval.offset = offset;
+            return true;
+        }
+        return unsupported(expr);
+    }
+
+    int load(const LValue &lval) {
+        if (lval.kind == LValue::REG)
+            return lval.where;
+        int dst = newTemp();
+        if (lval.kind == LValue::INDEXED)
+            emit(OP_LOADX, dst, lval.where, lval.offset);
+        else
+            emit(lval.kind == LValue::GLOBAL ? OP_LOADG : OP_LOAD, dst, lval.where);
+        return dst;
+    }
+
+    int store(const LValue &lval, int val) {
+        switch (lval.kind) {
+        case LValue::REG:
+            move(lval.where, val);
+            return lval.where;
+        case LValue::GLOBAL:
+            emit(OP_STOREG, lval.where, val);
+            return val;
+        case LValue::INDEXED:
+            emit(OP_STOREX, lval.where, lval.offset, val);
+            return val;
+        default:
+            emit(OP_STORE, lval.where, val);
+            return val;
+        }
+    }
+
+    /* 指令生成 */
+
+    void emit(OpCode op, long a = 0, long b = 0, long c = 0) {
+        Instruction inst = { op, (int)a, (int)b, (int)c };
+        mFunc->code.push_back(inst);
+    }
+
+    //把val搬到dst，如果val是上一条指令刚算出来的临时值，直接改写上一条指令的目标
+    void move(int dst, int val) {
+        if (dst == val)
+            return;
+        std::vector<Instruction> &code = mFunc->code;
+        if (val >= mFirstTemp && !code.empty() && code.size() != mLabelFence &&
+                code.back().a == val && writesA(code.back().op)) {
+            code.back().a = dst;
+            return;
+        }
+        emit(OP_MOV, dst, val);
+    }
+
+    static bool writesA(OpCode op) {
+        switch (op) {
+        case OP_STOREG: case OP_STORE: case OP_STOREX: case OP_JMP: case OP_JZ: case OP_JNZ:
+        case OP_RET: case OP_RETV: case OP_PRINT: case OP_FREE: case OP_TAILCALL: case OP_ZERO:
+        case OP_TICK:
+            return false;
+        default:
+            return !isCompareJump(op);
+        }
+    }
+
+    static bool isCompareJump(OpCode op) {
+        return op >= OP_JLT && op <= OP_JNEI;
+    }
+
+    //表达式是否为int范围内的整数字面值
+    static bool immediate(Expr *expr, long &imm) {
+        IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr->IgnoreParenImpCasts());
+        if (!integer || integer->getValue().getMinSignedBits() > 32)
+            return false;
+        imm = integer->getValue().getSExtValue();
+        return true;
+    }
+
+    //比较指令对应的比较跳转指令，jump_if_true为false时跳转条件取反，不是比较指令时返回OP_RETV
+    static OpCode compareJump(OpCode cmp, bool jump_if_true) {
+        static const OpCode taken[] = { OP_JLT, OP_JGT, OP_JLE, OP_JGE, OP_JEQ, OP_JNE };
+        static const OpCode negated[] = { OP_JGE, OP_JLE, OP_JGT, OP_JLT, OP_JNE, OP_JEQ };
+        if (cmp < OP_LT || cmp > OP_NE)
+            return OP_RETV;
+        return jump_if_true ? taken[cmp - OP_LT] : negated[cmp - OP_LT];
+    }
+
+    //kind类型上的运算指令，不支持时返回OP_RETV
+    static OpCode arithOp(BinaryOperatorKind opcode, ValueKind kind) {
+        if (kind == VK_I64 || kind == VK_PTR) {
+            switch (opcode) {
+            case BO_Add: return OP_ADDL;
+            case BO_Sub: return OP_SUBL;
+            case BO_Shl: return OP_SHLL;
+            case BO_Mul: return OP_MULL;
+            case BO_Div: return OP_DIVL;
+            case BO_Rem: return OP_REML;
+            case BO_LT:  return OP_LTL;
+            case BO_GT:  return OP_GTL;
+            case BO_LE:  return OP_LEL;
+            case BO_GE:  return OP_GEL;
+            case BO_EQ:  return OP_EQL;
+            case BO_NE:  return OP_NEL;
+            default:     break;
+            }
+        }
+        if (kind == VK_F64) {
+            switch (opcode) {
+            case BO_Add: return OP_ADDF;
+            case BO_Sub: return OP_SUBF;
+            case BO_Mul: return OP_MULF;
+            case BO_Div: return OP_DIVF;
+            case BO_LT:  return OP_LTF;
+            case BO_GT:  return OP_GTF;
+            case BO_LE:  return OP_LEF;
+            case BO_GE:  return OP_GEF;
+            case BO_EQ:  return OP_EQF;
+            case BO_NE:  return OP_NEF;
+            default:     return OP_RETV;    //double没有%和位运算
+            }
+        }
+        switch (opcode) {
+        case BO_Add: return OP_ADD;
+        case BO_Sub: return OP_SUB;
+        case BO_Mul: return OP_MUL;
+        case BO_Div: return OP_DIV;
+        case BO_Rem: return OP_REM;
+        case BO_And: return OP_AND;
+        case BO_Or:  return OP_OR;
+        case BO_Xor: return OP_XOR;
+        case BO_Shl: return OP_SHL;
+        case BO_Shr: return OP_SHR;
+        case BO_LT:  return OP_LT;
+        case BO_GT:  return OP_GT;
+        case BO_LE:  return OP_LE;
+        case BO_GE:  return OP_GE;
+        case BO_EQ:  return OP_EQ;
+        case BO_NE:  return OP_NE;
+        default:     return OP_RETV;    //表示不支持
+        }
+    }
+
+    size_t here() {
+        mLabelFence = mFunc->code.size();
+        return mLabelFence;
+    }
+
+    /* 生成跳转指令，返回它的位置。条件跳转紧跟在比较指令之后时合为一条比较跳转指令，
+     * 比较的右边是刚装入的常量时再合并为立即数形式，循环条件i < n每轮只需一条指令
+     */
+    size_t emitJump(OpCode op, int cond = 0) {
+        std::vector<Instruction> &code = mFunc->code;
+        size_t at = code.size();
+        if (op == OP_JMP) {
+            emit(op, 0);
+            return at;
+        }
+
+        //条件是上一条比较指令算出的临时值，并且没有其它跳转以这条比较之后为目标
+        OpCode fused = OP_RETV;
+        if (cond >= mFirstTemp && at > mLabelFence && code.back().a == cond)
+            fused = compareJump(code.back().op, op == OP_JNZ);
+        if (fused == OP_RETV) {
+            emit(op, cond, 0);
+            return at;
+        }
+        Instruction &cmp = code.back();
+        cmp.op = fused;
+        cmp.a = cmp.b;
+        cmp.b = cmp.c;
+        cmp.c = 0;
+        at = code.size() - 1;
+
+        //比较的右边是刚装入临时寄存器的常量
+        if (at >= mLabelFence + 1 && at >= 1) {
+            Instruction &load = code[at - 1];
+            if (load.op == OP_CONST && load.a == cmp.b && load.a >= mFirstTemp && load.a != cmp.a &&
+                    llvm::isInt<32>(mFunc->consts[load.b])) {
+                Instruction jump = { (OpCode)(fused - OP_JLT + OP_JLTI), cmp.a, (int)mFunc->consts[load.b], 0 };
+                code.pop_back();
+                code.back() = jump;
+                at = code.size() - 1;
+            }
+        }
+        return at;
+    }
+
+    //把跳转指令的目标设为当前位置
+    void bind(size_t jump) {
+        bindTo(jump, here());
+    }
+    void bindTo(size_t jump, size_t target) {
+        Instruction &inst = mFunc->code[jump];
+        if (inst.op == OP_JMP)
+            inst.a = target;
+        else if (isCompareJump(inst.op))
+            inst.c = target;
+        else
+            inst.b = target;
+    }
+
+    int newTemp() {
+        int reg = mNextTemp++;
+        if ((unsigned)mNextTemp > mFunc->numRegs)
+            mFunc->numRegs = mNextTemp;
+        return reg;
+    }
+
+    unsigned addConst(long val) {
+        mFunc->consts.push_back(val);
+        return mFunc->consts.size() - 1;
+    }
+
+    int constant(long val) {
+        int dst = newTemp();
+        emit(OP_CONST, dst, addConst(val));
+        return dst;
+    }
+
+    bool unsupported(Stmt *stmt) {
+        if (mError.empty())
+            mError = std::string("unsupported ") + stmt->getStmtClassName() + " in function " +
+                     mFunc->decl->getNameAsString();
+        return false;
+    }
+
+    const ASTContext &mContext;
+    Environment &mEnv;
+    BytecodeModule &mModule;
+
+    CompiledFunction *mFunc;
+    llvm::DenseMap<const VarDecl *, LocalVar> mLocals;
+    int mFirstTemp;
+    int mNextTemp;
+    //正在编译的函数能否把return f(...)编译为尾调用
+    bool mTailCalls;
+    //最近一次绑定标号的位置，这之前的指令不能被move改写
+    size_t mLabelFence;
+    //正在编译的嵌套循环，最后一个是最内层的
+    std::vector<LoopJumps> mLoops;
+    std::string mError;
+};
+
+class BytecodeVM {
+public:
+    BytecodeVM(Environment &env, const BytecodeModule &module)
+    : mEnv(env), mHeap(env.getHeap()), mStack(env.getStackRegion()), mModule(module), mJit(env.hasJit()), mRegs(), mFrames(),
+      mLayouts(), mPeakDepth(0), mPeakRegs(0) {
+        if (mJit) {
+            for (const CompiledFunction &func : module.functions)
+                mLayouts.push_back(env.getLayout(func.decl));
+        }
+    }
+
+    //从entry开始执行，直到entry返回
+    void run(FunctionDecl *entry) {
+        unsigned index = mModule.functionIndex.lookup(entry->getCanonicalDecl());
+        const CompiledFunction *fn = &mModule.functions[index];
+        mRegs.assign(fn->numRegs, 0);
+        mPeakRegs = fn->numRegs;
+
+        size_t base = 0;
+        const Instruction *code = fn->code.data();
+        const long *consts = fn->consts.data();
+        long *regs = mRegs.data();
+        size_t pc = 0;
+        unsigned long executed = 0;     //执行的指令条数，结束时计入统计
+
+        for (;;) {
+            const Instruction &inst = code[pc++];
+            ++executed;
+            switch (inst.op) {
+            case OP_CONST:  regs[inst.a] = consts[inst.b]; break;
+            case OP_MOV:    regs[inst.a] = regs[inst.b]; break;
+            case OP_LOADG:  regs[inst.a] = mHeap.Get(inst.b); break;
+            case OP_STOREG: mHeap.Update(inst.a, regs[inst.b]); break;
+            case OP_LOAD:   regs[inst.a] = mHeap.Get(regs[inst.b]); break;
+            case OP_STORE:  mHeap.Update(regs[inst.a], regs[inst.b]); break;
+            case OP_LOADX:  regs[inst.a] = mHeap.Get(regs[inst.b] + regs[inst.c]); break;
+            case OP_STOREX: mHeap.Update(regs[inst.a] + regs[inst.b], regs[inst.c]); break;
+            case OP_ADD:    regs[inst.a] = Arith<int>::add(regs[inst.b], regs[inst.c]); break;
+            case OP_ADDI:   regs[inst.a] = Arith<int>::add(regs[inst.b], inst.c); break;
+            case OP_SUB:    regs[inst.a] = Arith<int>::sub(regs[inst.b], regs[inst.c]); break;
+            case OP_MUL:    regs[inst.a] = Arith<int>::mul(regs[inst.b], regs[inst.c]); break;
+            case OP_DIV:    regs[inst.a] = (int)regs[inst.b] / (int)regs[inst.c]; break;
+            case OP_REM:    regs[inst.a] = (int)regs[inst.b] % (int)regs[inst.c]; break;
+            case OP_AND:    regs[inst.a] = regs[inst.b] & regs[inst.c]; break;
+            case OP_OR:     regs[inst.a] = regs[inst.b] | regs[inst.c]; break;
+            case OP_XOR:    regs[inst.a] = regs[inst.b] ^ regs[inst.c]; break;
+            case OP_SHL:    regs[inst.a] = (int)((unsigned)regs[inst.b] << regs[inst.c]); break;
+            case OP_SHR:    regs[inst.a] = regs[inst.b] >> regs[inst.c]; break;
+            case OP_LT:     regs[inst.a] = (int)regs[inst.b] < (int)regs[inst.c]; break;
+            case OP_GT:     regs[inst.a] = (int)regs[inst.b] > (int)regs[inst.c]; break;
+            case OP_LE:     regs[inst.a] = (int)regs[inst.b] <= (int)regs[inst.c]; break;
+            case OP_GE:     regs[inst.a] = (int)regs[inst.b] >= (int)regs[inst.c]; break;
+            case OP_EQ:     regs[inst.a] = (int)regs[inst.b] == (int)regs[inst.c]; break;
+            case OP_NE:     regs[inst.a] = (int)regs[inst.b] != (int)regs[inst.c]; break;
+            case OP_NEG:    regs[inst.a] = Arith<int>::neg(regs[inst.b]); break;
+            case OP_NOT:    regs[inst.a] = !regs[inst.b]; break;
+            case OP_BNOT:   regs[inst.a] = ~regs[inst.b]; break;
+            case OP_BOOL:   regs[inst.a] = regs[inst.b] != 0; break;
+            case OP_TRUNC:  regs[inst.a] = (int)regs[inst.b]; break;
+            case OP_MULL:   regs[inst.a] = Arith<long>::mul(regs[inst.b], regs[inst.c]); break;
+            case OP_DIVL:   regs[inst.a] = regs[inst.b] / regs[inst.c]; break;
+            case OP_REML:   regs[inst.a] = regs[inst.b] % regs[inst.c]; break;
+            case OP_LTL:    regs[inst.a] = regs[inst.b] < regs[inst.c]; break;
+            case OP_GTL:    regs[inst.a] = regs[inst.b] > regs[inst.c]; break;
+            case OP_LEL:    regs[inst.a] = regs[inst.b] <= regs[inst.c]; break;
+            case OP_GEL:    regs[inst.a] = regs[inst.b] >= regs[inst.c]; break;
+            case OP_EQL:    regs[inst.a] = regs[inst.b] == regs[inst.c]; break;
+            case OP_NEL:    regs[inst.a] = regs[inst.b] != regs[inst.c]; break;
+            case OP_ADDL:   regs[inst.a] = Arith<long>::add(regs[inst.b], regs[inst.c]); break;
+            case OP_ADDIL:  regs[inst.a] = Arith<long>::add(regs[inst.b], inst.c); break;
+            case OP_SUBL:   regs[inst.a] = Arith<long>::sub(regs[inst.b], regs[inst.c]); break;
+            case OP_SHLL:   regs[inst.a] = (long)((unsigned long)regs[inst.b] << regs[inst.c]); break;
+            case OP_NEGL:   regs[inst.a] = Arith<long>::neg(regs[inst.b]); break;
+            case OP_ADDF:   regs[inst.a] = word(real(regs[inst.b]) + real(regs[inst.c])); break;
+            case OP_SUBF:   regs[inst.a] = word(real(regs[inst.b]) - real(regs[inst.c])); break;
+            case OP_MULF:   regs[inst.a] = word(real(regs[inst.b]) * real(regs[inst.c])); break;
+            case OP_DIVF:   regs[inst.a] = word(real(regs[inst.b]) / real(regs[inst.c])); break;
+            case OP_LTF:    regs[inst.a] = real(regs[inst.b]) < real(regs[inst.c]); break;
+            case OP_GTF:    regs[inst.a] = real(regs[inst.b]) > real(regs[inst.c]); break;
+            case OP_LEF:    regs[inst.a] = real(regs[inst.b]) <= real(regs[inst.c]); break;
+            case OP_GEF:    regs[inst.a] = real(regs[inst.b]) >= real(regs[inst.c]); break;
+            case OP_EQF:    regs[inst.a] = real(regs[inst.b]) == real(regs[inst.c]); break;
+            case OP_NEF:    regs[inst.a] = real(regs[inst.b]) != real(regs[inst.c]); break;
+            case OP_NEGF:   regs[inst.a] = word(-real(regs[inst.b])); break;
+            case OP_I2F:    regs[inst.a] = word((double)regs[inst.b]); break;
+            case OP_F2I:    regs[inst.a] = (long)real(regs[inst.b]); break;
+            case OP_BOOLF:  regs[inst.a] = real(regs[inst.b]) != 0.0; break;
+            case OP_JMP:    pc = inst.a; break;
+            case OP_JZ:     if (!regs[inst.a]) pc = inst.b; break;
+            case OP_JNZ:    if (regs[inst.a]) pc = inst.b; break;
+            case OP_JLT:    if ((int)regs[inst.a] < (int)regs[inst.b]) pc = inst.c; break;
+            case OP_JGT:    if ((int)regs[inst.a] > (int)regs[inst.b]) pc = inst.c; break;
+            case OP_JLE:    if ((int)regs[inst.a] <= (int)regs[inst.b]) pc = inst.c; break;
+            case OP_JGE:    if ((int)regs[inst.a] >= (int)regs[inst.b]) pc = inst.c; break;
+            case OP_JEQ:    if ((int)regs[inst.a] == (int)regs[inst.b]) pc = inst.c; break;
+            case OP_JNE:    if ((int)regs[inst.a] != (int)regs[inst.b]) pc = inst.c; break;
+            case OP_JLTI:   if ((int)regs[inst.a] < inst.b) pc = inst.c; break;
+            case OP_JGTI:   if ((int)regs[inst.a] > inst.b) pc = inst.c; break;
+            case OP_JLEI:   if ((int)regs[inst.a] <= inst.b) pc = inst.c; break;
+            case OP_JGEI:   if ((int)regs[inst.a] >= inst.b) pc = inst.c; break;
+            case OP_JEQI:   if ((int)regs[inst.a] == inst.b) pc = inst.c; break;
+            case OP_JNEI:   if ((int)regs[inst.a] != inst.b) pc = inst.c; break;
+            case OP_TICK:
+                //与遍历语法树时的backEdge一样，回边次数计入当前函数，下一次调用可能编译为本地代码
+                if (mJit)
+                    ++mLayouts[fn - mModule.functions.data()]->backedges;
+                if (!mEnv.tick(mModule.sites[inst.a])) {
+                    finish(executed);
+                    return;
+                }
+                break;
+            case OP_ALLOCA:
+                regs[inst.a] = mStack.alloc(inst.b);
+                mEnv.afterAlloc();
+                break;
+            case OP_ZERO: {
+                long *cells = mHeap.Data(regs[inst.a], inst.b);
+                std::fill(cells, cells + inst.b, 0);
+                break;
+            }
+            case OP_GET:
+                regs[inst.a] = mEnv.input();
+                break;
+            case OP_PRINT:
+                mEnv.output(regs[inst.a]);
+                break;
+            case OP_MALLOC:
+                regs[inst.a] = mEnv.allocate((int)regs[inst.b] / sizeof(int), mModule.sites[inst.c]);
+                //超出堆的预算时终止
+                if (!regs[inst.a]) {
+                    finish(executed);
+                    return;
+                }
+                break;
+            case OP_FREE:
+                mHeap.Free(regs[inst.a]);
+                break;
+            case OP_NATIVE:
+                regs[inst.a] = mEnv.callBinding(inst.b, regs + inst.c);
+                //找不到实现或者本地函数发现错误时终止
+                if (mEnv.isTrapped()) {
+                    finish(executed);
+                    return;
+                }
+                break;
+            case OP_CALL: {
+                const CompiledFunction *callee = &mModule.functions[inst.b];
+                //超出执行预算时终止，位置记为被调函数的函数体
+                if (!mEnv.tick(callee->decl->getBody())) {
+                    finish(executed);
+                    return;
+                }
+                //已经编译为本地代码的函数直接调用，实参在调用者的寄存器中
+                if (mJit) {
+                    if (void *native = mEnv.enterNative(callee->decl)) {
+                        regs[inst.a] = mEnv.callNative(native, callee->decl, regs + inst.c);
+                        break;
+                    }
+                }
+                if (mFrames.size() + 1 >= mEnv.getMaxDepth()) {
+                    mEnv.trap("stack overflow: call depth exceeds " + std::to_string(mEnv.getMaxDepth()));
+                    finish(executed);
+                    return;
+                }
+                ++mEnv.getStats().calls;
+                Frame frame = { fn, pc, base, inst.a, mStack.mark() };
+                mFrames.push_back(frame);
+                if (mFrames.size() > mPeakDepth)
+                    mPeakDepth = mFrames.size();
+
+                //被调函数的寄存器紧接在调用者之后
+                size_t callee_base = base + fn->numRegs;
+                if (mPeakRegs < callee_base + callee->numRegs)
+                    mPeakRegs = callee_base + callee->numRegs;
+                if (mRegs.size() < callee_base + callee->numRegs)
+                    mRegs.resize(std::max(mRegs.size() * 2, callee_base + callee->numRegs));
+                regs = mRegs.data();
+                for (unsigned i = 0; i < callee->numParams; ++i)
+                    regs[callee_base + i] = regs[base + inst.c + i];
+
+                fn = callee;
+                base = callee_base;
+                regs += base;
+                code = fn->code.data();
+                consts = fn->consts.data();
+                pc = 0;
+                break;
+            }
+            case OP_TAILCALL: {
+                const CompiledFunction *callee = &mModule.functions[inst.b];
+                if (!mEnv.tick(callee->decl->getBody())) {
+                    finish(executed);
+                    return;
+                }
+                //本地代码照常调用，结果由后面的OP_RET返回
+                if (mJit) {
+                    if (void *native = mEnv.enterNative(callee->decl)) {
+                        regs[inst.a] = mEnv.callNative(native, callee->decl, regs + inst.c);
+                        break;
+                    }
+                }
+                ++mEnv.getStats().calls;
+
+                //被调函数的寄存器从当前栈帧的起点开始，实参在更高的临时寄存器中，从前往后复制不会覆盖
+                if (mRegs.size() < base + callee->numRegs)
+                    mRegs.resize(std::max(mRegs.size() * 2, base + callee->numRegs));
+                regs = mRegs.data() + base;
+                for (unsigned i = 0; i < callee->numParams; ++i)
+                    regs[i] = regs[inst.c + i];
+
+                fn = callee;
+                code = fn->code.data();
+                consts = fn->consts.data();
+                pc = 0;
+                break;
+            }
+            case OP_RET:
+            case OP_RETV: {
+                long val = inst.op == OP_RET ? regs[inst.a] : 0;
+                //主函数的返回值作为退出状态
+                if (mFrames.empty()) {
+                    mEnv.setExitCode(val);
+                    finish(executed);
+                    return;
+                }
+                Frame frame = mFrames.back();
+                mFrames.pop_back();
+                mStack.release(frame.stack);
+
+                fn = frame.fn;
+                base = frame.base;
+                regs = mRegs.data() + base;
+                code = fn->code.data();
+                consts = fn->consts.data();
+                pc = frame.pc;
+                regs[frame.ret] = val;
+                break;
+            }
+            }
+        }
+    }
+
+private:
+    //执行结束，把指令条数和栈帧的峰值计入统计，栈帧数包括入口函数
+    void finish(unsigned long executed) {
+        ExecStats &stats = mEnv.getStats();
+        stats.instructions += executed;
+        stats.framePeakDepth = mPeakDepth + 1;
+        stats.framePeakBytes = mPeakRegs * sizeof(long) + mPeakDepth * sizeof(Frame);
+        stats.frameReservedBytes = mRegs.capacity() * sizeof(long) + mFrames.capacity() * sizeof(Frame);
+    }
+
+    //double在寄存器中保存为位模式
+    static double real(long word) {
+        return Word<double>::get(word);
+    }
+    static long word(double val) {
+        return Word<double>::make(val);
+    }
+
+    //调用者的现场，被调函数返回后据此恢复
+    struct Frame {
+        const CompiledFunction *fn;
+        size_t pc;
+        size_t base;
+        int ret;
+        StackMark stack;    //调用时栈内存的栈顶，被调函数返回时释放到这里
+    };
+
+    Environment &mEnv;
+    Heap &mHeap;
+    //局部数组和被取地址的局部变量所在的栈内存
+    StackRegion &mStack;
+    const BytecodeModule &mModule;
+    //是否启用了JIT，没有启用时调用不需要计数
+    bool mJit;
+    //所有栈帧的寄存器连续存放
+    std::vector<long> mRegs;
+    std::vector<Frame> mFrames;
+    //启用JIT时各函数(与functions的下标相同)的栈帧布局，用于记录循环回边
+    std::vector<FrameLayout *> mLayouts;
+    //调用栈的最大深度和寄存器的最大用量
+    size_t mPeakDepth;
+    size_t mPeakRegs;
+};
+
+#endif  // ~BYTECODE_HPP
@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hpp"
+
+/* cinterpreter --serve的客户端，用法与cinterpreter相同：
+ * 选项原样转发给服务端，源程序由客户端读出后发送，程序的输出写到标准错误，
+ * 程序需要输入时读标准输入转发给服务端，最后以程序的退出状态退出
+ */
+
+static void usage() {
+    std::cerr << "Usage: ciclient [--socket=SOCKET] [--bytecode] [--jit] [--jit-threshold=N] <file.c>" << std::endl;
+}
+
+static int connectTo(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (fd < 0 || path.size() >= sizeof(addr.sun_path))
+        return -1;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    std::string socket_path = kDefaultSocket;
+    if (const char *env = getenv("CINTERPRETER_SOCKET"))
+        socket_path = env;
+
+    std::vector<std::string> args;
+    std::string file;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--socket=") == 0)
+            socket_path = arg.substr(9);
+        else if (arg.size() > 1 && arg[0] == '-')
+            args.push_back(arg);
+        else
+            file = arg;
+    }
+
+    if (file.empty()) {
+        std::cerr << "Please input .c file" << std::endl;
+        usage();
+        return -1;
+    }
+    std::ifstream source_file(file);
+    if (!source_file) {
+        std::cerr << "Cannot open " << file << std::endl;
+        return -1;
+    }
+    std::string source(std::istreambuf_iterator<char>{source_file},
+                       std::istreambuf_iterator<char>{});
+
+    int fd = connectTo(socket_path);
+    if (fd < 0) {
+        std::cerr << "Cannot connect to " << socket_path << std::endl;
+        return -1;
+    }
+
+    bool ok = true;
+    for (const std::string &arg : args)
+        ok = ok && writeFrame(fd, FRAME_ARG, arg);
+    ok = ok && writeFrame(fd, FRAME_SOURCE, source) && writeFrame(fd, FRAME_GO, "");
+
+    char tag;
+    std::string payload;
+    while (ok && readFrame(fd, tag, payload)) {
+        if (tag == FRAME_OUTPUT)
+            writeAll(STDERR_FILENO, payload.data(), payload.size());
+        else if (tag == FRAME_READ) {
+            //交互使用时一次读到一行，从管道读时一次读一块
+            char buffer[4096];
+            ssize_t n;
+            do {
+                n = read(STDIN_FILENO, buffer, sizeof(buffer));
+            } while (n < 0 && errno == EINTR);
+            ok = writeFrame(fd, FRAME_INPUT, std::string(buffer, n > 0 ? n : 0));
+        }
+        else if (tag == FRAME_EXIT) {
+            close(fd);
+            return atoi(payload.c_str());
+        }
+    }
+
+    std::cerr << "Connection to " << socket_path << " lost" << std::endl;
+    close(fd);
+    return -1;
+}
@@ -1,232 +1,468 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <iterator>
+#include <functional>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/EvaluatedExprVisitor.h"
+#include "clang/Frontend/ASTUnit.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
+#include "clang/Lex/Preprocessor.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/Support/FileSystem.h"
 
 using namespace clang;
 
 #include "environment.hpp"
+#include "bytecode.hpp"
+#include "jit.hpp"
+#include "astcache.hpp"
+#include "serve.hpp"
+#include "batch.hpp"
+#include "profiler.hpp"
+#include "optimizer.hpp"
+#include "repl.hpp"
+
+//命令行选项
+struct Options {
+    std::string file;   //要执行的.c文件
+    bool bytecode;      //是否编译为字节码执行，否则遍历语法树执行
+    bool jit;           //是否把热点函数编译为本地代码
+    unsigned long jitThreshold; //调用次数与循环回边次数之和达到多少时编译
+    bool fastIO;                //不输出提示，输入输出都经过大缓冲区
+    std::string cacheDir;       //语法树缓存目录，为空时不使用缓存
+    std::string serve;          //服务模式监听的套接字，为空时直接执行file
+    std::string batch;          //批量执行的清单，为空时直接执行file
+    unsigned jobs;              //批量执行的工作线程数，0表示与CPU核数相同
+    std::string results;        //批量执行的结果文件，为空时输出到标准输出
+    std::string stats;          //执行统计的输出文件，为空时不输出
+    std::string profile;        //性能分析的折叠栈输出文件，为空时不分析
+    unsigned profileTop;        //性能分析报告中列出的函数和行数
+    std::string heapReport;     //堆统计的JSON输出文件，为空时不统计
+    bool optimize;              //执行前是否化简语法树
+    size_t maxDepth;            //函数调用的最大深度，超过时程序以栈溢出终止
+    unsigned long maxSteps;     //执行预算：循环回边和调用的次数、墙钟毫秒数、堆的单元数，0表示不限制
+    unsigned long maxMillis;
+    size_t maxCells;
+    std::vector<std::string> nativeLibs;    //没有定义的函数到这些共享库中查找
+    bool repl;                  //交互式执行，不读入file
+    bool processSymbols;        //服务模式下是否允许绑定进程中的libc函数，其它方式总是允许
+
+    Options()
+    : file(), bytecode(false), jit(false), jitThreshold(1000), fastIO(false), cacheDir(), serve(), batch(), jobs(0),
+      results(), stats(), profile(), profileTop(20), heapReport(), optimize(true), maxDepth(Environment::kDefaultMaxDepth),
+      maxSteps(0), maxMillis(0), maxCells(0), nativeLibs(), repl(false), processSymbols(false) {}
+};
 
 class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor> {
 public:
     explicit InterpreterVisitor(const ASTContext &context, Environment *env)
-    : EvaluatedExprVisitor(context), mEnv(env) {}
+    : EvaluatedExprVisitor(context), mEnv(env), mProfiler(NULL) {}
     virtual ~InterpreterVisitor() {}
 
-    /* 以下函数对抽象语法树进行遍历，每个函数调用都有一个栈帧，栈帧内记录了一个
-     * 函数是否已经返回，如果已经返回，则后续代码都不执行，所以每个函数开头都有
-     * 一段if语句用于判断函数是否已经返回
+    void setProfiler(Profiler *profiler) {
+        mProfiler = profiler;
+    }
+
+    /* 语句由execStmt执行，返回执行结果：return、break和continue不再执行同一语句块中
+     * 后面的语句，而是直接逐层返回到所在的循环或者函数调用处，表达式求值时不需要检查
+     * 函数是否已经返回。表达式由以下Visit函数求值，每个表达式求值后恰好在操作数栈上
+     * 留下一个值，表达式语句执行完后丢弃它留下的值
      */
+    enum Completion {
+        CompletionNormal,
+        CompletionBreak,
+        CompletionContinue,
+        CompletionReturn
+    };
+
+    //求值表达式，宿主栈将要用完时终止程序，表达式的值为0
+    void Visit(Stmt *stmt) {
+        if (Environment::hostStackLow()) {
+            mEnv->trapHostStack();
+            if (isa<Expr>(stmt))
+                mEnv->push(0);
+            return ;
+        }
+        EvaluatedExprVisitor::Visit(stmt);
+    }
+
+    /* 依次求值子表达式。基类的VisitStmt调用的是StmtVisitorBase::Visit，不经过上面的检查，
+     * 二元运算、类型转换、调用参数等的递归都走这里，所以要改为调用本类的Visit
+     */
+    void VisitStmt(Stmt *stmt) {
+        for (Stmt *child : stmt->children())
+            if (child)
+                Visit(child);
+    }
+
+    //执行一条语句
+    Completion execStmt(Stmt *stmt) {
+        if (Environment::hostStackLow()) {
+            mEnv->trapHostStack();
+            return CompletionReturn;
+        }
+        if (mProfiler)
+            mProfiler->hit(stmt);
+        size_t mark = mEnv->markOperands();
+        switch (stmt->getStmtClass()) {
+        case Stmt::CompoundStmtClass:
+            return execCompound(cast<CompoundStmt>(stmt));
+        case Stmt::IfStmtClass:
+            return execIf(cast<IfStmt>(stmt));
+        case Stmt::WhileStmtClass:
+            return execWhile(cast<WhileStmt>(stmt));
+        case Stmt::DoStmtClass:
+            return execDo(cast<DoStmt>(stmt));
+        case Stmt::ForStmtClass:
+            return execFor(cast<ForStmt>(stmt));
+        case Stmt::ReturnStmtClass:
+            return execReturn(cast<ReturnStmt>(stmt));
+        case Stmt::BreakStmtClass:
+            return CompletionBreak;
+        case Stmt::ContinueStmtClass:
+            return CompletionContinue;
+        case Stmt::NullStmtClass:
+            return CompletionNormal;
+        default:
+            break;
+        }
+        //表达式语句和声明语句，丢弃求值留在操作数栈上的值
+        Visit(stmt);
+        mEnv->releaseOperands(mark);
+        //程序在调用中被终止时，不再执行后面的语句
+        return mEnv->isTrapped() ? CompletionReturn : CompletionNormal;
+    }
 
     //处理二元操作符
     virtual void VisitBinaryOperator(BinaryOperator *bop) {
-        if (mEnv->hasReturn()) {
-            return ;
+        //赋值时左边只计算地址，不需要取出原来的值
+        if (bop->isAssignmentOp()) {
+            Expr *left = bop->getLHS()->IgnoreParens();
+            if (UnaryOperator *uop = dyn_cast<UnaryOperator>(left)) {
+                if (uop->getOpcode() == UO_Deref)
+                    Visit(uop->getSubExpr());
+            }
+            else if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(left)) {
+                Visit(array->getLHS());
+                Visit(array->getRHS());
+            }
+            Visit(bop->getRHS());
         }
-
-        VisitStmt(bop);
+        else
+            VisitStmt(bop);
         mEnv->binop(bop);
     }
 
     //处理一元操作符
     virtual void VisitUnaryOperator(UnaryOperator *uop) {
-        if (mEnv->hasReturn()) {
-            return ;
+        //取地址时只计算地址所需的子表达式：&a[i]中的a和i，&*p中的p
+        if (uop->getOpcode() == UO_AddrOf) {
+            Expr *sub_expr = uop->getSubExpr()->IgnoreParens();
+            if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(sub_expr)) {
+                Visit(array->getLHS());
+                Visit(array->getRHS());
+            }
+            else if (UnaryOperator *deref = dyn_cast<UnaryOperator>(sub_expr)) {
+                if (deref->getOpcode() == UO_Deref)
+                    Visit(deref->getSubExpr());
+            }
         }
-
-        VisitStmt(uop);
+        else
+            VisitStmt(uop);
         mEnv->unaryop(uop);
     }
 
     //处理括号括起来的表达式
     virtual void VisitParenExpr(ParenExpr *paren_expr) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
+        //括号表达式的值就是子表达式的值，已经在操作数栈顶
         VisitStmt(paren_expr);
-        mEnv->paren(paren_expr);
     }
 
     //sizeof
     virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *uett) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
-        VisitStmt(uett);
+        //sizeof的操作数不求值
         mEnv->sizeOf(uett);
     }
 
     //处理数组下标访问
     virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *array_expr) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
         VisitStmt(array_expr);
         mEnv->array(array_expr);
     }
     
     //分析声明的变量
     virtual void VisitDeclStmt(DeclStmt *declstmt) {
-        if (mEnv->hasReturn()) {
-            return ;
+        //一条语句可能声明多个变量，逐个计算初始值并绑定，这样int a=1, b=2, c=a+b;也能正确执行
+        for (Decl *decl : declstmt->decls()) {
+            if (VarDecl *vardecl = dyn_cast<VarDecl>(decl)) {
+                if (vardecl->hasInit())
+                    Visit(vardecl->getInit());
+                mEnv->decl(vardecl);
+            }
         }
-
-        //TODO:int a=1, b=2, c=a+b;不能被正确执行
-        VisitStmt(declstmt);    //如果有初始值，应该先计算出初始值，否则调用decl时找不到值
-	    mEnv->decl(declstmt);
     }
     
     //将引用的变量的值放到栈上
     virtual void VisitDeclRefExpr(DeclRefExpr *expr) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
 	    VisitStmt(expr);
 	    mEnv->declref(expr);
     }
 
     //处理整数字面值，比如100、10
     virtual void VisitIntegerLiteral(IntegerLiteral *integer) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
         mEnv->integerLiteral(integer);
     }
 
-    virtual void VisitCastExpr(CastExpr *expr) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
+    //处理字符字面值，比如'a'
+    virtual void VisitCharacterLiteral(CharacterLiteral *character) {
+        mEnv->characterLiteral(character);
+    }
+
+    //处理浮点数字面值，比如0.5
+    virtual void VisitFloatingLiteral(FloatingLiteral *floating) {
+        mEnv->floatingLiteral(floating);
+    }
 
+    virtual void VisitCastExpr(CastExpr *expr) {
 	    VisitStmt(expr);
 	    mEnv->cast(expr);
     }
 
     //处理函数调用
     virtual void VisitCallExpr(CallExpr *call) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
 	    VisitStmt(call);
-	    mEnv->call(call);   //设置好环境
+        //设置好环境，内建函数和已编译为本地代码的函数在这里就执行完了
+	    if (!mEnv->call(call))
+            return ;
         //执行函数体
         FunctionDecl *callee = call->getDirectCallee();
-        Stmt *body = callee->getBody();
-        if (body)
-            VisitStmt(body);
+        if (mProfiler)
+            mProfiler->enter(callee);
+        runFunction(callee);
+        if (mProfiler)
+            mProfiler->leave();
         //重新设置环境，以执行函数调用后面的语句
         mEnv->afterCall(call);
     }
 
-    //处理函数返回语句
-    virtual void VisitReturnStmt(ReturnStmt *retstmt) {
-        if (mEnv->hasReturn()) {
-            return ;
+    //执行函数体，函数体以尾调用结束时当前栈帧已经换成被调函数的，接着执行被调函数的函数体
+    void runFunction(FunctionDecl *fdecl) {
+        for (;;) {
+            if (Stmt *body = fdecl->getBody())
+                execStmt(body);
+            FunctionDecl *next = mEnv->takeTailCall();
+            if (!next)
+                return ;
+            if (mProfiler) {
+                mProfiler->leave();
+                mProfiler->enter(next);
+            }
+            fdecl = next;
         }
+    }
+
+  private:
+    //处理语句块，块内声明的数组在块结束时释放
+    Completion execCompound(CompoundStmt *compound) {
+        StackMark mark = mEnv->markStack();
+        for (Stmt *stmt : compound->body()) {
+            Completion completion = execStmt(stmt);
+            if (completion != CompletionNormal) {
+                if (completion != CompletionReturn)
+                    mEnv->releaseStack(mark);
+                return completion;
+            }
+        }
+        mEnv->releaseStack(mark);
+        return CompletionNormal;
+    }
 
-        VisitStmt(retstmt);
+    //处理函数返回语句
+    Completion execReturn(ReturnStmt *retstmt) {
+        //return f(...)：实参求值后由被调函数的栈帧替换当前栈帧，当前函数有栈内存时照常调用
+        CallExpr *tail = tailCall(retstmt);
+        if (tail && !mEnv->hasStackMemory()) {
+            VisitStmt(tail);
+            if (mEnv->tailCall(tail))
+                return CompletionReturn;
+        }
+        else
+            VisitStmt(retstmt);
         mEnv->ret(retstmt);
+        return CompletionReturn;
     }
 
     //处理if语句(支持分支内定义新变量)，if/for/while语句块不新建栈帧，
     //因为这些块内声明的变量在块外引用时将引起语法分析器的错误状态
-    virtual void VisitIfStmt(IfStmt *ifstmt) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
+    Completion execIf(IfStmt *ifstmt) {
         //计算条件表达式
         Expr *cond_expr = ifstmt->getCond();
         Visit(cond_expr);      //TODO:为什么不能使用VistStmt(cond_expr)
         bool cond = mEnv->caculateCond(cond_expr);
 
-        //根据条件表达式选择分支
-        if (cond) {
-            Stmt *then_body = ifstmt->getThen();
-            if (then_body)
-                Visit(then_body);   //此处使用VisitStmt不能访问不加花括号的if语句
-        }
-        else {
-            Stmt *else_body = ifstmt->getElse();
-            if (else_body)
-                Visit(else_body);
-        }
+        //根据条件表达式选择分支，break、continue和return交给外层处理
+        Stmt *body = cond ? ifstmt->getThen() : ifstmt->getElse();
+        if (body)
+            return execStmt(body);
+        return CompletionNormal;
     }
 
     //处理while语句(循环体内可以声明新变量)
-    virtual void VisitWhileStmt(WhileStmt *whilestmt) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
-
-        //计算条件表达式
+    Completion execWhile(WhileStmt *whilestmt) {
         Expr *cond_expr = whilestmt->getCond();
-        Visit(cond_expr);
-        bool cond = mEnv->caculateCond(cond_expr);
+        LoopPlan plan = loopPlan(whilestmt, cond_expr, NULL);
 
         //根据条件进行循环
         Stmt *while_body = whilestmt->getBody();
-        while (cond) {
-            if (while_body)
-                Visit(while_body);      //TODO:可能无法访问不加花括号的while语句, 已解决
-            //更新循环条件
-            Visit(cond_expr);
-            cond = mEnv->caculateCond(cond_expr);
+        while (loopCond(cond_expr, plan)) {
+            Completion completion = execStmt(while_body);
+            if (completion == CompletionBreak)
+                break;
+            if (completion == CompletionReturn)
+                return completion;
+            if (!mEnv->backEdge(whilestmt))
+                return CompletionReturn;
         }
+        return CompletionNormal;
     }
 
-    //处理for语句(循环体内可以声明新变量，不清楚是否为概率行为)
-    virtual void VisitForStmt(ForStmt *forstmt) {
-        if (mEnv->hasReturn()) {
-            return ;
-        }
+    //处理do-while语句，先执行一次循环体，continue跳到条件处
+    Completion execDo(DoStmt *dostmt) {
+        Expr *cond_expr = dostmt->getCond();
+        LoopPlan plan = loopPlan(dostmt, cond_expr, NULL);
+
+        Stmt *do_body = dostmt->getBody();
+        do {
+            Completion completion = execStmt(do_body);
+            if (completion == CompletionBreak)
+                break;
+            if (completion == CompletionReturn)
+                return completion;
+            if (!mEnv->backEdge(dostmt))
+                return CompletionReturn;
+        } while (loopCond(cond_expr, plan));
+        return CompletionNormal;
+    }
 
+    //处理for语句(循环体内可以声明新变量，不清楚是否为概率行为)
+    Completion execFor(ForStmt *forstmt) {
         //初始化，TODO:初始化语句不能声明新变量
         Stmt *init_stmt = forstmt->getInit();
-        if (init_stmt)
-            VisitStmt(init_stmt);
+        if (init_stmt && execStmt(init_stmt) == CompletionReturn)
+            return CompletionReturn;
 
         //循环条件
         Expr *cond_expr = forstmt->getCond();
-        Visit(cond_expr);
-        bool cond = mEnv->caculateCond(cond_expr);
-
-        //循环体
-        Stmt *for_body = forstmt->getBody();    //循环体
         Expr *inc_expr = forstmt->getInc();     //迭代表达式，如i++
-        while (cond)
-        {
-            if (for_body)
-                Visit(for_body);
-            if (inc_expr)
-                Visit(inc_expr);
-            
-            //更新循环条件
-            Visit(cond_expr);
-            cond = mEnv->caculateCond(cond_expr);
+        LoopPlan plan = loopPlan(forstmt, cond_expr, inc_expr);
+        //填充、复制、逐元素运算和求和的循环一次批量执行完，之后超出执行预算时终止
+        if (plan.idiom && mEnv->runIdiom(plan.loop, forstmt))
+            return mEnv->isTrapped() ? CompletionReturn : CompletionNormal;
+
+        //循环体，continue之后仍然执行迭代表达式
+        Stmt *for_body = forstmt->getBody();
+        while (loopCond(cond_expr, plan)) {
+            Completion completion = execStmt(for_body);
+            if (completion == CompletionBreak)
+                break;
+            if (completion == CompletionReturn)
+                return completion;
+            if (plan.fusedStep)
+                mEnv->stepFused(plan.step);
+            else if (inc_expr && execStmt(inc_expr) == CompletionReturn)
+                return CompletionReturn;
+
+            if (!mEnv->backEdge(forstmt))
+                return CompletionReturn;
         }
+        return CompletionNormal;
+    }
+
+    //返回值是否直接为用户函数的调用，改变值的类型转换(如int转为double)要在调用返回后执行，不能作为尾调用
+    static CallExpr *tailCall(ReturnStmt *retstmt) {
+        Expr *ret_expr = retstmt->getRetValue();
+        if (!ret_expr)
+            return NULL;
+        ret_expr = ret_expr->IgnoreParens();
+        while (ImplicitCastExpr *implicit = dyn_cast<ImplicitCastExpr>(ret_expr)) {
+            if (isValueCast(implicit->getCastKind()))
+                return NULL;
+            ret_expr = implicit->getSubExpr()->IgnoreParens();
+        }
+        CallExpr *call = dyn_cast<CallExpr>(ret_expr);
+        if (!call || !call->getDirectCallee() || !call->getDirectCallee()->hasBody())
+            return NULL;
+        return call;
+    }
+
+    //循环条件和迭代表达式能否融合执行，每个循环语句只识别一次
+    struct LoopPlan {
+        bool fusedCond;
+        FusedCond cond;
+        bool fusedStep;
+        FusedStep step;
+        bool idiom;         //整个for循环是否为批量操作的惯用法
+        LoopIdiom loop;
+    };
+
+    LoopPlan loopPlan(Stmt *loop, Expr *cond_expr, Expr *inc_expr) {
+        auto it = mLoopPlans.find(loop);
+        if (it != mLoopPlans.end())
+            return it->second;
+        LoopPlan plan;
+        plan.fusedCond = cond_expr && mEnv->fuseCond(cond_expr, plan.cond);
+        plan.fusedStep = inc_expr && mEnv->fuseStep(inc_expr, plan.step);
+        //性能分析要统计循环体每一行的执行次数，不批量执行
+        ForStmt *forstmt = dyn_cast<ForStmt>(loop);
+        plan.idiom = forstmt && !mProfiler && plan.fusedCond && plan.fusedStep &&
+                     mEnv->fuseIdiom(forstmt, plan.cond, plan.step, plan.loop);
+        mLoopPlans[loop] = plan;
+        return plan;
+    }
+
+    //计算循环条件，没有条件时恒为真，程序在条件中的调用里被终止时结束循环
+    bool loopCond(Expr *cond_expr, const LoopPlan &plan) {
+        if (plan.fusedCond)
+            return mEnv->testFused(plan.cond);
+        if (!cond_expr)
+            return true;
+        Visit(cond_expr);
+        return mEnv->caculateCond(cond_expr) && !mEnv->isTrapped();
     }
 
-  private:
     Environment *mEnv;
+    //性能分析，NULL表示不分析
+    Profiler *mProfiler;
+    llvm::DenseMap<Stmt *, LoopPlan> mLoopPlans;
 };
 
 class InterpreterConsumer : public ASTConsumer {
 public:
-    explicit InterpreterConsumer(const ASTContext& context) : mEnv(),
-    	    mVisitor(context, &mEnv) {
+    explicit InterpreterConsumer(const ASTContext& context, const Options &options,
+                                 std::unique_ptr<NativeCompiler> jit, ProgramIO &io,
+                                 llvm::raw_ostream &err, Profiler *profiler = NULL, HeapTracker *heap = NULL)
+    : mEnv(), mVisitor(context, &mEnv), mOptions(options), mJit(std::move(jit)), mErr(err),
+      mRanBytecode(false), mProfiler(profiler) {
+        mVisitor.setProfiler(profiler);
+        mEnv.setHeapTracker(heap);
+        mEnv.setIO(&io);
+        mEnv.setMaxDepth(mOptions.maxDepth);
+        ExecBudget budget = { mOptions.maxSteps, mOptions.maxMillis, mOptions.maxCells };
+        mEnv.setBudget(budget);
+        if (mJit)
+            mEnv.setJit(mJit.get(), mOptions.jitThreshold);
     }
     virtual ~InterpreterConsumer() noexcept {}
 
@@ -235,32 +471,511 @@ public:
 	    mEnv.init(decl);
 
 	    FunctionDecl *entry = mEnv.getEntry();
-	    mVisitor.VisitStmt(entry->getBody());
+        if (mOptions.bytecode) {
+            //编译失败时退回到遍历语法树的方式执行
+            BytecodeModule module;
+            BytecodeCompiler compiler(Context, mEnv, module);
+            if (compiler.compile(decl)) {
+                BytecodeVM vm(mEnv, module);
+                mRanBytecode = true;
+                vm.run(entry);
+                reportTrap(Context.getSourceManager());
+                return ;
+            }
+            mErr << "bytecode: " << compiler.getError()
+                 << ", falling back to the AST interpreter\n";
+        }
+        if (mProfiler)
+            mProfiler->enter(entry);
+	    mVisitor.runFunction(entry);
+        if (mProfiler)
+            mProfiler->finish();
+        reportTrap(Context.getSourceManager());
+    }
+
+    //程序的退出状态
+    int getExitCode() {
+        return mEnv.getExitCode();
+    }
+
+    //实际使用的执行方式，字节码编译失败时为遍历语法树
+    const char *getMode() {
+        return mRanBytecode ? "bytecode" : "ast";
+    }
+    ExecStats getStats() {
+        return mEnv.finalStats();
     }
 private:
+    //输出终止的原因，知道位置时(例如超出执行预算)附上行号和列号
+    void reportTrap(const SourceManager &sm) {
+        if (!mEnv.isTrapped())
+            return ;
+        mErr << "error: " << mEnv.getTrap();
+        if (const Stmt *site = mEnv.getTrapSite()) {
+            //批处理的各线程共用一个ASTUnit，SourceManager查行号时会改写内部缓存
+            std::lock_guard<std::mutex> lock(astContextMutex());
+            PresumedLoc loc = sm.getPresumedLoc(sm.getExpansionLoc(site->getLocStart()));
+            if (loc.isValid())
+                mErr << " at line " << loc.getLine() << ":" << loc.getColumn();
+        }
+        mErr << "\n";
+    }
+
     Environment mEnv;
     InterpreterVisitor mVisitor;
+    const Options &mOptions;
+    std::unique_ptr<NativeCompiler> mJit;
+    //解释器自身的提示信息
+    llvm::raw_ostream &mErr;
+    bool mRanBytecode;
+    Profiler *mProfiler;
 };
 
-class InterpreterClassAction : public ASTFrontendAction {
-public: 
-    virtual std::unique_ptr<clang::ASTConsumer> CreateASTConsumer(
-        clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
-            return std::unique_ptr<clang::ASTConsumer>(
-                new InterpreterConsumer(Compiler.getASTContext()));
-        }
+/* REPL的执行端：Environment在整个会话中一直存在，全局变量和堆在各次输入之间保留。
+ * 语法树随输入增长，字节码和本地代码都要整个程序一起编译，所以输入只在遍历语法树的方式下执行
+ */
+class ReplSession : public ReplBackend {
+public:
+    ReplSession(ASTContext &context, const Options &options, llvm::raw_ostream &err)
+    : mEnv(), mVisitor(context, &mEnv), mOptimizer(context), mOptimize(options.optimize), mErr(err) {
+        mEnv.setMaxDepth(options.maxDepth);
+    }
+
+    virtual void declare(Decl *decl, bool execute) {
+        if (mOptimize)
+            mOptimizer.optimize(decl);
+        mEnv.declare(decl);
+        //全局变量的初始值可以引用之前输入的变量和函数，在空栈帧中求值
+        VarDecl *vdecl = dyn_cast<VarDecl>(decl);
+        if (!execute || !vdecl || !vdecl->hasInit())
+            return ;
+        mEnv.enterEntry(NULL);
+        mVisitor.Visit(vdecl->getInit());
+        long val = mEnv.pop();
+        if (!reportTrap())
+            mEnv.setVar(vdecl, val);
+        mEnv.leaveEntry();
+    }
+
+    virtual bool run(FunctionDecl *fdecl, long &val) {
+        mEnv.enterEntry(fdecl);
+        mVisitor.runFunction(fdecl);
+        val = mEnv.getRetVal();
+        bool trapped = reportTrap();
+        mEnv.leaveEntry();
+        return !trapped;
+    }
+
+private:
+    //输出终止的原因，这次输入的其余部分不再执行，之后的输入照常执行
+    bool reportTrap() {
+        if (!mEnv.isTrapped())
+            return false;
+        mErr << "error: " << mEnv.getTrap() << "\n";
+        return true;
+    }
+
+    Environment mEnv;
+    InterpreterVisitor mVisitor;
+    ASTOptimizer mOptimizer;
+    bool mOptimize;
+    llvm::raw_ostream &mErr;
+};
+
+//一次执行的统计，用于--stats
+struct RunStats {
+    ExecStats exec;
+    std::string mode;       //ast或bytecode
+    double parseMillis;     //解析或从缓存加载的时间
+    double runMillis;       //执行的时间
+
+    RunStats() : exec(), mode(), parseMillis(0), runMillis(0) {}
 };
 
+static double millisSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* 在mmap分配的栈上启动一个线程执行fn并等待它结束。遍历语法树时每层函数调用都要在宿主栈上
+ * 递归若干层Visit，默认8MB的栈只够几万层，所以按最大调用深度预留足够的地址空间，
+ * MAP_NORESERVE使得只有实际用到的页才占用内存，最低的一页作为保护页。
+ * 按调用深度估计的大小不一定够用，所以栈底之上留出kStackReserve作为Environment::stackLimit，
+ * 解释器在调用和求值时检查，越过时以栈溢出终止。创建线程失败时直接在当前线程上执行
+ */
+static const size_t kStackReserve = 256 << 10;
+
+//在当前线程自己的栈上执行fn，栈的下界取自线程属性
+static void runOnCurrentStack(const std::function<void()> &fn) {
+    const char *saved = Environment::stackLimit();
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        void *low;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &low, &size) == 0 && size > 2 * kStackReserve)
+            Environment::stackLimit() = static_cast<const char *>(low) + kStackReserve;
+        pthread_attr_destroy(&attr);
+    }
+    fn();
+    Environment::stackLimit() = saved;
+}
+
+static void runOnLargeStack(size_t max_depth, const std::function<void()> &fn) {
+    //每层调用在宿主栈上占用的字节数的估计值
+    const size_t kFrameBytes = 8 << 10;
+    const size_t kMinStack = 8 << 20;
+    const size_t kMaxStack = (size_t)64 << 30;
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = max_depth < kMaxStack / kFrameBytes ? max_depth * kFrameBytes : kMaxStack;
+    size = std::max(size, kMinStack);
+    size = (size + page - 1) / page * page;
+
+    void *stack = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                       -1, 0);
+    if (stack == MAP_FAILED) {
+        runOnCurrentStack(fn);
+        return ;
+    }
+    mprotect(stack, page, PROT_NONE);
+    struct Start {
+        const std::function<void()> *fn;
+        const char *limit;
+    } start = { &fn, static_cast<const char *>(stack) + page + kStackReserve };
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    bool started = false;
+    if (pthread_attr_init(&attr) == 0) {
+        started = pthread_attr_setstack(&attr, stack, size) == 0 &&
+                  pthread_create(&thread, &attr, [](void *arg) -> void * {
+                      Start *start = static_cast<Start *>(arg);
+                      Environment::stackLimit() = start->limit;
+                      (*start->fn)();
+                      return NULL;
+                  }, &start) == 0;
+        pthread_attr_destroy(&attr);
+    }
+    if (started)
+        pthread_join(thread, NULL);
+    else
+        runOnCurrentStack(fn);
+    munmap(stack, size);
+}
+
+/* 执行前化简语法树，每棵语法树只化简一次：命令行方式在存入缓存之后，
+ * 服务模式在每次重新解析之后，批量执行在解析之后、多个作业共享之前
+ */
+static void optimizeProgram(ASTUnit &unit, const Options &options) {
+    if (!options.optimize)
+        return ;
+    ASTContext &context = unit.getASTContext();
+    ASTOptimizer optimizer(context);
+    optimizer.run(context.getTranslationUnitDecl());
+}
+
+//在解析好的语法树上执行程序，语法树可能来自解析、缓存或者服务模式，返回程序的退出状态
+static int runProgram(ASTUnit &unit, const Options &options, ProgramIO &io, llvm::raw_ostream &err,
+                      RunStats *stats = NULL) {
+    auto start = std::chrono::steady_clock::now();
+    ASTContext &context = unit.getASTContext();
+    //性能分析只在遍历语法树时进行，字节码和本地代码不经过InterpreterVisitor
+    std::unique_ptr<Profiler> profiler;
+    Options run_options = options;
+    if (!options.profile.empty()) {
+        profiler.reset(new Profiler(context.getSourceManager()));
+        if (options.bytecode || options.jit)
+            err << "profile: ignoring --bytecode and --jit, profiling runs on the AST interpreter\n";
+        run_options.bytecode = false;
+        run_options.jit = false;
+    }
+    //本地代码不检查执行预算
+    if (run_options.jit && (options.maxSteps || options.maxMillis || options.maxCells)) {
+        err << "budget: ignoring --jit, native code does not check the execution budget\n";
+        run_options.jit = false;
+    }
+    std::unique_ptr<HeapTracker> heap;
+    if (!options.heapReport.empty())
+        heap.reset(new HeapTracker());
+    std::unique_ptr<NativeCompiler> jit;
+    if (run_options.jit) {
+        Preprocessor &pp = unit.getPreprocessor();
+        jit.reset(new JitCompiler(context, unit.getDiagnostics(),
+                                  pp.getHeaderSearchInfo().getHeaderSearchOpts(),
+                                  pp.getPreprocessorOpts()));
+    }
+    InterpreterConsumer consumer(context, run_options, std::move(jit), io, err, profiler.get(), heap.get());
+    runOnLargeStack(run_options.maxDepth, [&consumer, &context]() {
+        consumer.HandleTranslationUnit(context);
+    });
+    io.flush();
+    if (profiler) {
+        std::error_code ec;
+        llvm::raw_fd_ostream folded(options.profile, ec, llvm::sys::fs::F_Text);
+        if (ec)
+            err << "cannot write " << options.profile << ": " << ec.message() << "\n";
+        else
+            profiler->writeFolded(folded);
+        profiler->report(err, options.profileTop);
+    }
+    if (heap) {
+        std::error_code ec;
+        llvm::raw_fd_ostream json(options.heapReport, ec, llvm::sys::fs::F_Text);
+        if (ec)
+            err << "cannot write " << options.heapReport << ": " << ec.message() << "\n";
+        else
+            heap->writeJson(json, context.getSourceManager());
+        heap->report(err, context.getSourceManager());
+    }
+    if (stats) {
+        stats->exec = consumer.getStats();
+        stats->mode = consumer.getMode();
+        stats->runMillis = millisSince(start);
+    }
+    return consumer.getExitCode();
+}
+
+//以JSON格式输出统计，峰值内存取自getrusage
+static bool writeStats(const std::string &file, const RunStats &stats, int exit_code) {
+    std::error_code ec;
+    llvm::raw_fd_ostream os(file, ec, llvm::sys::fs::F_Text);
+    if (ec) {
+        std::cerr << "cannot write " << file << ": " << ec.message() << std::endl;
+        return false;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    const ExecStats &exec = stats.exec;
+    double seconds = stats.runMillis / 1000;
+    unsigned long ops = stats.mode == "bytecode" ? exec.instructions : exec.nodes;
+
+    os << "{\n"
+       << "  \"mode\": " << jsonString(stats.mode) << ",\n"
+       << "  \"exit_code\": " << exit_code << ",\n"
+       << "  \"parse_ms\": " << stats.parseMillis << ",\n"
+       << "  \"run_ms\": " << stats.runMillis << ",\n"
+       << "  \"nodes\": " << exec.nodes << ",\n"
+       << "  \"instructions\": " << exec.instructions << ",\n"
+       << "  \"ops_per_sec\": " << (seconds > 0 ? ops / seconds : 0) << ",\n"
+       << "  \"calls\": " << exec.calls << ",\n"
+       << "  \"heap_cells\": " << exec.heapCells << ",\n"
+       << "  \"heap_peak_cells\": " << exec.heapPeakCells << ",\n"
+       << "  \"frame_peak_depth\": " << exec.framePeakDepth << ",\n"
+       << "  \"frame_peak_bytes\": " << exec.framePeakBytes << ",\n"
+       << "  \"frame_reserved_bytes\": " << exec.frameReservedBytes << ",\n"
+       << "  \"peak_rss_kb\": " << usage.ru_maxrss << "\n"
+       << "}\n";
+    return true;
+}
+
+//解析一个选项，不认识的选项返回false
+static bool parseOption(const std::string &arg, Options &options) {
+    if (arg == "--bytecode")
+        options.bytecode = true;
+    else if (arg == "--jit")
+        options.jit = true;
+    else if (arg.compare(0, 16, "--jit-threshold=") == 0) {
+        options.jit = true;
+        options.jitThreshold = strtoul(arg.c_str() + 16, NULL, 10);
+    }
+    else if (arg == "--fast-io")
+        options.fastIO = true;
+    else if (arg.compare(0, 12, "--cache-dir=") == 0)
+        options.cacheDir = arg.substr(12);
+    else if (arg == "--serve")
+        options.serve = kDefaultSocket;
+    else if (arg.compare(0, 8, "--serve=") == 0)
+        options.serve = arg.substr(8);
+    else if (arg.compare(0, 8, "--batch=") == 0)
+        options.batch = arg.substr(8);
+    else if (arg.compare(0, 7, "--jobs=") == 0)
+        options.jobs = strtoul(arg.c_str() + 7, NULL, 10);
+    else if (arg.compare(0, 10, "--results=") == 0)
+        options.results = arg.substr(10);
+    else if (arg.compare(0, 8, "--stats=") == 0)
+        options.stats = arg.substr(8);
+    else if (arg == "--profile")
+        options.profile = "profile.folded";
+    else if (arg.compare(0, 10, "--profile=") == 0)
+        options.profile = arg.substr(10);
+    else if (arg.compare(0, 14, "--profile-top=") == 0)
+        options.profileTop = strtoul(arg.c_str() + 14, NULL, 10);
+    else if (arg == "--heap-report")
+        options.heapReport = "heap.json";
+    else if (arg.compare(0, 14, "--heap-report=") == 0)
+        options.heapReport = arg.substr(14);
+    else if (arg == "--no-optimize")
+        options.optimize = false;
+    else if (arg.compare(0, 12, "--max-depth=") == 0)
+        options.maxDepth = strtoul(arg.c_str() + 12, NULL, 10);
+    else if (arg.compare(0, 12, "--max-steps=") == 0)
+        options.maxSteps = strtoul(arg.c_str() + 12, NULL, 10);
+    else if (arg.compare(0, 11, "--max-time=") == 0)
+        options.maxMillis = strtoul(arg.c_str() + 11, NULL, 10);
+    else if (arg.compare(0, 11, "--max-heap=") == 0)
+        options.maxCells = strtoul(arg.c_str() + 11, NULL, 10);
+    else if (arg.compare(0, 13, "--native-lib=") == 0)
+        options.nativeLibs.push_back(arg.substr(13));
+    else if (arg == "--allow-process-symbols")
+        options.processSymbols = true;
+    else if (arg == "--repl")
+        options.repl = true;
+    else
+        return false;
+    return true;
+}
+
+//服务模式下执行一个请求，客户端只能指定执行方式
+static int serveProgram(ASTUnit &unit, const std::vector<std::string> &args, ProgramIO &io,
+                        llvm::raw_ostream &err) {
+    Options options;
+    for (const std::string &arg : args) {
+        if (!parseOption(arg, options) || !options.cacheDir.empty() || !options.serve.empty() ||
+                !options.batch.empty() || !options.stats.empty() || !options.profile.empty() ||
+                !options.heapReport.empty() || !options.nativeLibs.empty() || options.repl || options.processSymbols) {
+            err << "Unknown option: " << arg << "\n";
+            return -1;
+        }
+    }
+    optimizeProgram(unit, options);
+    return runProgram(unit, options, io, err);
+}
+
+//批量执行清单中的作业，结果以JSON格式输出
+static int runBatch(const Options &options) {
+    BatchRunner batch([&options](ASTUnit &unit, ProgramIO &io, llvm::raw_ostream &err) {
+        return runProgram(unit, options, io, err);
+    }, [&options](ASTUnit &unit) {
+        optimizeProgram(unit, options);
+    }, options.jobs);
+    std::string error;
+    if (!batch.loadManifest(options.batch, error)) {
+        std::cerr << error << std::endl;
+        return -1;
+    }
+    batch.run();
+
+    if (options.results.empty()) {
+        batch.writeResults(llvm::outs());
+        return 0;
+    }
+    std::error_code ec;
+    llvm::raw_fd_ostream os(options.results, ec, llvm::sys::fs::F_Text);
+    if (ec) {
+        std::cerr << "cannot write " << options.results << ": " << ec.message() << std::endl;
+        return -1;
+    }
+    batch.writeResults(os);
+    return 0;
+}
+
+/* 交互式执行：输入逐条增量解析到同一个ASTContext中，在同一个Environment中执行。
+ * 解析也可能深度递归，所以整个会话都在大栈上进行
+ */
+static int runRepl(const Options &options) {
+    if (options.bytecode || options.jit)
+        std::cerr << "repl: ignoring --bytecode and --jit, entries run on the AST interpreter" << std::endl;
+    runOnLargeStack(options.maxDepth, [&options]() {
+        IncrementalParser parser;
+        ReplSession session(parser.getASTContext(), options, llvm::errs());
+        Repl repl(parser, session, llvm::outs());
+        repl.run(std::cin);
+    });
+    return 0;
+}
+
+static void usage() {
+    std::cerr << "Usage: cinterpreter [--bytecode] [--jit] [--jit-threshold=N] [--fast-io] [--cache-dir=DIR]" << std::endl;
+    std::cerr << "                   [--stats=FILE] [--profile[=FILE]] [--profile-top=N] [--heap-report[=FILE]]" << std::endl;
+    std::cerr << "                   [--no-optimize] [--max-depth=N] [--max-steps=N] [--max-time=MS] [--max-heap=CELLS]" << std::endl;
+    std::cerr << "                   [--native-lib=LIB]... <file.c>" << std::endl;
+    std::cerr << "       cinterpreter --repl [--max-depth=N] [--native-lib=LIB]..." << std::endl;
+    std::cerr << "       cinterpreter --serve[=SOCKET] [--allow-process-symbols] [--native-lib=LIB]..." << std::endl;
+    std::cerr << "       cinterpreter --batch=MANIFEST [--jobs=N] [--results=FILE] [--bytecode] [--jit]" << std::endl;
+}
+
 int main (int argc, char **argv) {
-    if (argc > 1) {
-        std::ifstream source_file(argv[1]);
-        std::string source(std::istreambuf_iterator<char>{source_file},
-                           std::istreambuf_iterator<char>{});
-        clang::tooling::runToolOnCode(new InterpreterClassAction, source);
-    } else {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (parseOption(arg, options))
+            continue;
+        else if (arg.size() > 1 && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            usage();
+            return -1;
+        }
+        else
+            options.file = arg;
+    }
+
+    //共享库在执行任何程序之前加载，服务模式和批量执行的所有程序共用
+    for (const std::string &lib : options.nativeLibs) {
+        std::string error;
+        if (!Environment::natives().loadLibrary(lib, error)) {
+            std::cerr << error << std::endl;
+            return -1;
+        }
+    }
+
+    if (options.repl)
+        return runRepl(options);
+    //服务模式执行的是不受信任的程序，除非启动时允许，否则只能调用内建函数和--native-lib中的函数
+    if (!options.serve.empty()) {
+        Environment::natives().setProcessSymbols(options.processSymbols);
+        return Server(options.serve, serveProgram).run();
+    }
+    if (!options.batch.empty()) {
+        if (!options.profile.empty()) {
+            std::cerr << "--profile cannot be used with --batch" << std::endl;
+            return -1;
+        }
+        if (!options.heapReport.empty()) {
+            std::cerr << "--heap-report cannot be used with --batch" << std::endl;
+            return -1;
+        }
+        return runBatch(options);
+    }
+
+    if (options.file.empty()) {
         std::cerr << "Please input .c file" << std::endl;
+        usage();
         return -1;
     }
 
-    return 0;
+    std::ifstream source_file(options.file);
+    std::string source(std::istreambuf_iterator<char>{source_file},
+                       std::istreambuf_iterator<char>{});
+
+    //有缓存时直接加载语法树，否则解析源程序，解析成功后存入缓存
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<ASTCache> cache;
+    std::unique_ptr<ASTUnit> unit;
+    if (!options.cacheDir.empty()) {
+        cache.reset(new ASTCache(options.cacheDir));
+        unit = cache->load(source);
+    }
+    if (!unit) {
+        unit = cache ? tooling::buildASTFromCode(source, "input.cc", cache->getPCHContainerOps())
+                     : tooling::buildASTFromCode(source);
+        if (!unit)
+            return 1;
+        /* 与原来一样，有编译错误时仍然在恢复后的语法树上执行，例如按C++解析时
+         * int *p = malloc(...)会报错，但是测试程序依赖这种写法；有错误的程序不缓存
+         */
+        if (cache && !unit->getDiagnostics().hasErrorOccurred())
+            cache->save(*unit, source);
+    }
+
+    optimizeProgram(*unit, options);
+    RunStats stats;
+    stats.parseMillis = millisSince(start);
+    int exit_code;
+    if (options.fastIO) {
+        BufferedIO io;
+        exit_code = runProgram(*unit, options, io, llvm::errs(), &stats);
+    }
+    else
+        exit_code = runProgram(*unit, options, ConsoleIO::instance(), llvm::errs(), &stats);
+    if (!options.stats.empty())
+        writeStats(options.stats, stats, exit_code);
+    return exit_code;
 }
@@ -1,9 +1,16 @@
 #ifndef ENVIRONMENT_HPP
 #define ENVIRONMENT_HPP
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/Decl.h"
@@ -11,41 +18,103 @@
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendAction.h"
 #include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/MathExtras.h"
+
+#include "heapstats.hpp"
+#include "io.hpp"
+#include "natives.hpp"
+#include "simd.hpp"
+#include "values.hpp"
 
 using namespace clang;
 
+//收集函数体内声明的局部变量
+class LocalVarFinder : public RecursiveASTVisitor<LocalVarFinder> {
+public:
+    explicit LocalVarFinder(std::vector<VarDecl *> &vars) : mVars(vars) {}
+
+    bool VisitVarDecl(VarDecl *var) {
+        if (var->isLocalVarDecl())
+            mVars.push_back(var);
+        return true;
+    }
+
+private:
+    std::vector<VarDecl *> &mVars;
+};
+
+//找出被取地址的变量，这些变量必须放在内存中，其余变量留在槽位或寄存器中
+class AddrTakenFinder : public RecursiveASTVisitor<AddrTakenFinder> {
+public:
+    explicit AddrTakenFinder(llvm::DenseSet<const VarDecl *> &vars) : mVars(vars) {}
+
+    bool VisitUnaryOperator(UnaryOperator *uop) {
+        if (uop->getOpcode() != UO_AddrOf)
+            return true;
+        if (DeclRefExpr *ref = dyn_cast<DeclRefExpr>(uop->getSubExpr()->IgnoreParens()))
+            if (VarDecl *var = dyn_cast<VarDecl>(ref->getDecl()))
+                if (!var->getType()->isArrayType())
+                    mVars.insert(var);
+        return true;
+    }
+
+private:
+    llvm::DenseSet<const VarDecl *> &mVars;
+};
+
+struct FrameLayout;
+
+//栈内存(见StackRegion)的栈顶位置，函数返回或语句块结束时退回到这里
+struct StackMark {
+    size_t chunk;
+    long top;
+};
+
 class StackFrame {
 private:
     /// StackFrame maps Variable Declaration to Value
     /// Which are either integer or addresses (also represented using an Integer value)
-    std::map<Decl*, long> mVars;
-    std::map<Stmt*, long> mExprs;   //值的类型设为long，保证保存地址时不溢出
+    /// 局部变量和参数按Environment预先分配的槽位连续存放，槽位由FrameArena分配
+    long *mVars;
+    unsigned mSize;
+    //槽位所在的FrameArena块，弹出栈帧时交还
+    unsigned mChunk;
     /// The current stmt
     Stmt *mPC;
+    //进入这个栈帧时操作数栈的高度，返回时操作数栈恢复到这个高度
+    size_t mOperandBase;
+    //进入这个栈帧时栈内存的栈顶，返回时栈内存退回到这里
+    StackMark mStackMark;
+    //正在执行的函数的栈帧布局，循环回边计数记在这里
+    FrameLayout *mLayout;
 
     //表征函数是否已经返回
     bool _hasReturn;
 
   public:
-    StackFrame() : mVars(), mExprs(), mPC(), _hasReturn(false) {
+    StackFrame() : mVars(NULL), mSize(0), mChunk(0), mPC(), mOperandBase(0), mStackMark(), mLayout(NULL), _hasReturn(false) {
     }
 
-    //更新和获取变量的值
-    void bindDecl(Decl *decl, long val) {
-        mVars[decl] = val;
+    //设置栈帧的槽位，槽位的内存属于FrameArena
+    void setSlots(long *slots, unsigned size, unsigned chunk) {
+        mVars = slots;
+        mSize = size;
+        mChunk = chunk;
     }
-    long getDeclVal(Decl *decl) {
-        assert (mVars.find(decl) != mVars.end());
-        return mVars.find(decl)->second;
+    unsigned getChunk() {
+        return mChunk;
     }
 
-    //更新和获取表达式的值
-    void bindStmt(Stmt *stmt, long val) {
-		  mExprs[stmt] = val;
+    //更新和获取变量的值
+    void bindSlot(unsigned slot, long val) {
+        assert (slot < mSize);
+        mVars[slot] = val;
     }
-    long getStmtVal(Stmt *stmt) {
-		  assert (mExprs.find(stmt) != mExprs.end());
-		  return mExprs[stmt];
+    long getSlotVal(unsigned slot) {
+        assert (slot < mSize);
+        return mVars[slot];
     }
 
     //这两个函数用于函数调用返回地址设置
@@ -56,6 +125,30 @@ private:
 		return mPC;
     }
 
+    //设置和获取进入栈帧时操作数栈的高度
+    void setOperandBase(size_t base) {
+        mOperandBase = base;
+    }
+    size_t getOperandBase() {
+        return mOperandBase;
+    }
+
+    //设置和获取进入栈帧时栈内存的栈顶
+    void setStackMark(StackMark mark) {
+        mStackMark = mark;
+    }
+    StackMark getStackMark() {
+        return mStackMark;
+    }
+
+    //设置和获取栈帧所属函数的布局
+    void setLayout(FrameLayout *layout) {
+        mLayout = layout;
+    }
+    FrameLayout *getLayout() {
+        return mLayout;
+    }
+
     //设置和检查函数是否return
     void setReturn(bool flag) {
         _hasReturn = flag;
@@ -64,141 +157,534 @@ private:
         return _hasReturn;
     }
 
-    //以下为对变量表的查找遍历接口
-    std::map<Decl*, long>::iterator mVars_begin() {
-        return mVars.begin();
+    //以下为对变量表的整体访问接口
+    unsigned size() {
+        return mSize;
     }
-    std::map<Decl*, long>::iterator mVars_end() {
-        return mVars.end();
+    long *slots() {
+        return mVars;
     }
-    std::map<Decl*, long>::iterator mVars_find(Decl *decl) {
-        return mVars.find(decl);
+};
+
+/* 栈帧的槽位区：用户函数栈帧的槽位按调用顺序在大块内存中连续分配，
+ * 进入和离开函数只移动栈顶，不再为每次调用分配内存。块分配后一直保留给后面的调用使用，
+ * 一个栈帧不跨块，所以槽位的地址在栈帧存在期间不变
+ */
+class FrameArena {
+public:
+    FrameArena() : mChunks(), mChunk(0), mTop(0), mDepth(0), mPeakDepth(0), mUsed(0), mPeakUsed(0), mReserved(0) {}
+
+    //分配size个清零的槽位，chunk返回槽位所在的块
+    long *push(unsigned size, unsigned &chunk) {
+        if (mChunks.empty() || mTop + size > mChunks[mChunk].size)
+            advance(size);
+        long *slots = mChunks[mChunk].cells.get() + mTop;
+        std::fill(slots, slots + size, 0);
+        mTop += size;
+        chunk = mChunk;
+        mUsed += size;
+        if (mUsed > mPeakUsed)
+            mPeakUsed = mUsed;
+        if (++mDepth > mPeakDepth)
+            mPeakDepth = mDepth;
+        return slots;
+    }
+
+    //释放最近分配的槽位，必须按分配的相反顺序释放
+    void pop(long *slots, unsigned size, unsigned chunk) {
+        assert(chunk < mChunks.size() && mDepth > 0);
+        mChunk = chunk;
+        mTop = slots - mChunks[chunk].cells.get();
+        mUsed -= size;
+        --mDepth;
+    }
+
+    //同时存在的栈帧数、槽位占用的字节数的最大值，以及分配的块的总字节数
+    size_t peakDepth() const {
+        return mPeakDepth;
     }
+    size_t peakBytes() const {
+        return mPeakUsed * sizeof(long);
+    }
+    size_t reservedBytes() const {
+        return mReserved * sizeof(long);
+    }
+
+private:
+    //每块的单元数，比这大的栈帧单独占一块
+    static const size_t kChunkCells = 64 * 1024;
+
+    struct Chunk {
+        std::unique_ptr<long[]> cells;
+        size_t size;
+    };
+
+    //换到下一块，下一块不够大时换成足够大的新块
+    void advance(unsigned size) {
+        size_t next = mChunks.empty() ? 0 : mChunk + 1;
+        if (next == mChunks.size() || mChunks[next].size < size) {
+            Chunk chunk;
+            chunk.size = std::max<size_t>(kChunkCells, size);
+            chunk.cells.reset(new long[chunk.size]);
+            if (next < mChunks.size()) {
+                mReserved -= mChunks[next].size;
+                mChunks[next] = std::move(chunk);
+            }
+            else
+                mChunks.push_back(std::move(chunk));
+            mReserved += mChunks[next].size;
+        }
+        mChunk = next;
+        mTop = 0;
+    }
+
+    std::vector<Chunk> mChunks;
+    size_t mChunk;      //栈顶所在的块
+    size_t mTop;        //栈顶在块中的位置
+    size_t mDepth;
+    size_t mPeakDepth;
+    size_t mUsed;       //正在使用的槽位数
+    size_t mPeakUsed;
+    size_t mReserved;   //所有块的单元数
 };
 
 /* 内存管理，以long为单元进行管理，内存地址表示是第几个long，0地址表示nullptr
- * 所有数组和指针的地址都是从0开始的虚拟地址，所有求地址的表达式都将分配一个虚拟地址，
- * 并记录虚拟地址到实际地址的映射关系
+ * 数组、malloc分配的内存和被取地址的变量都放在这里，指针的值就是内存地址
+ * 所有单元连续存放在一块可增长的缓冲区中，地址就是下标。每个内存块前后各有一个边界标记，
+ * 记录块的大小和是否已分配；空闲块按大小分级挂在空闲链表上，释放时与相邻的空闲块合并，
+ * 位于缓冲区末尾的空闲块直接归还
  */
 class Heap {
 public:
-    Heap() : mBuffers(), mValues(), mPointers(), min_addr(1) {}
-
-    //分配内存，直接分配size个long类型单元
-    long Malloc(long size) {
-        long buffer = min_addr;
-        min_addr = min_addr + size;
-        mBuffers[buffer] = size;
+    Heap() : mCells(1, 0), mPeakCells(1), mTracker(NULL), mLimit(0), mOverLimit(false) {   //0号单元不使用，保证0地址表示nullptr
+        for (int i = 0; i < kNumClasses; ++i)
+            mFreeLists[i] = 0;
+    }
 
-        for (long i = 0; i < size; ++i)
-            mValues[buffer + i] = 0;
+    //分配内存，直接分配size个long类型单元，并初始化为0，site为程序中调用malloc的表达式
+    long Malloc(long size, const Stmt *site = NULL) {
+        assert(size >= 0);
+        long need = size < kMinBlock ? kMinBlock : size;
+        long block = takeFree(need);
+        if (0 == block) {   //没有合适的空闲块，从缓冲区末尾分配
+            block = mCells.size();
+            //超过上限时程序的malloc返回空指针，解释器自己的分配照常进行，由Environment终止程序
+            if (mLimit && (size_t)(block + need + 2) > mLimit) {
+                mOverLimit = true;
+                if (site)
+                    return 0;
+            }
+            mCells.resize(block + need + 2);
+            setTags(block, need, true);
+            if (mCells.size() > mPeakCells)
+                mPeakCells = mCells.size();
+        }
 
-        return buffer;
+        long *payload = &mCells[block + 1];
+        std::fill(payload, payload + blockSize(block), 0);
+        if (mTracker)
+            mTracker->allocated(block + 1, size, site);
+        return block + 1;
     }
 
     //释放内存，释放的内存必须是通过Malloc分配的
     void Free(long buffer) {
         if (0 == buffer)    //保证空指针不出错
             return ;
-        assert(mBuffers.find(buffer) != mBuffers.end());
-        long size = mBuffers[buffer];
-        for (long i = 0; i < size; ++i)
-            mValues.erase(mValues.find(buffer + i));
-        mBuffers.erase(mBuffers.find(buffer));
-        
-        //如果释放的内存位于分配的内存末尾，可以减小min_addr的值，其它情况不再考虑
-        if (buffer + size == min_addr)
-            min_addr = buffer;
+        long block = buffer - 1;
+        assert(buffer > 0 && buffer < (long)mCells.size() && isUsed(block));
+        if (mTracker)
+            mTracker->freed(buffer);
+        long size = blockSize(block);
+
+        //与后一个空闲块合并
+        long next = block + size + 2;
+        if (next < (long)mCells.size() && !isUsed(next)) {
+            unlink(next);
+            size += blockSize(next) + 2;
+        }
+        //与前一个空闲块合并，前一个块的尾部标记紧挨着本块的头部标记
+        if (block > 1 && !isUsed(block - 1)) {
+            long prev = block - blockSize(block - 1) - 2;
+            unlink(prev);
+            size += blockSize(prev) + 2;
+            block = prev;
+        }
+
+        //如果释放的内存位于缓冲区末尾，直接缩小缓冲区
+        if (block + size + 2 == (long)mCells.size()) {
+            mCells.resize(block);
+            return ;
+        }
+        setTags(block, size, false);
+        insertFree(block);
     }
 
     //更新某个地址的值
     void Update(long addr, long val) {
-        // if (addr > min_addr || addr <= 0)
-        //    std::cout << "Segment Default!" << std::endl;
-        assert(mValues.find(addr) != mValues.end());
-        mValues[addr] = val;
+        assert(addr > 0 && addr < (long)mCells.size());
+        mCells[addr] = val;
+    }
+
+    //统计每次分配和释放，NULL表示不统计
+    void setTracker(HeapTracker *tracker) {
+        mTracker = tracker;
+    }
+
+    //缓冲区单元数的上限，0表示不限制
+    void setLimit(size_t cells) {
+        mLimit = cells;
+    }
+    //是否有分配超过了上限
+    bool overLimit() const {
+        return mOverLimit;
+    }
+
+    //缓冲区当前的单元数和曾经达到的最大单元数
+    size_t cells() {
+        return mCells.size();
+    }
+    size_t peakCells() {
+        return mPeakCells;
     }
 
     //获取某个地址的值
     long Get(long addr) {
-        // if (addr > min_addr || addr <= 0)
-        //    std::cout << "Segment Default!" << std::endl;
-        assert(mValues.find(addr) != mValues.end());
-        return mValues[addr];
+        assert(addr > 0 && addr < (long)mCells.size());
+        return mCells[addr];
     }
 
-    //获取某个地址的实际地址
-    Expr *getRealAddr(long addr) {
-        if (mPointers.find(addr) != mPointers.end())
-            return mPointers[addr];     //普通变量的指针将返回其表达式指针，随后更改其实际地址处的值
-        else
-            return nullptr;             //数组元素的指针不需要更改实际地址处的值
+    //从addr开始连续size个单元，供本地函数直接访问，越界时返回NULL
+    long *Data(long addr, long size) {
+        if (addr <= 0 || size < 0 || addr + size > (long)mCells.size())
+            return NULL;
+        return mCells.data() + addr;
+    }
+
+  private:
+    //空闲链表按块大小的以2为底的对数分级
+    static const int kNumClasses = 64;
+    //块至少要能放下空闲链表的前后指针
+    static const long kMinBlock = 2;
+
+    /* 块的布局：[头部标记][size个单元][尾部标记]，标记为(size << 1) | 是否已分配，
+     * 空闲块的前两个单元分别存放空闲链表中下一个和上一个块的头部地址
+     */
+    long blockSize(long block) {
+        return mCells[block] >> 1;
+    }
+    bool isUsed(long block) {
+        return mCells[block] & 1;
+    }
+    void setTags(long block, long size, bool used) {
+        mCells[block] = mCells[block + size + 1] = (size << 1) | (used ? 1 : 0);
+    }
+    static int sizeClass(long size) {
+        return llvm::Log2_64(size);
     }
 
-    //获取某个实际地址的虚拟地址，如果没有，则返回0，表明需要分配
-    long getImageAddr(Expr *addr) {
-        for (auto i = mPointers.begin(), e = mPointers.end(); i != e; ++i)
-            if (i->second == addr)
-                return i->first;
+    void insertFree(long block) {
+        long &head = mFreeLists[sizeClass(blockSize(block))];
+        mCells[block + 1] = head;
+        mCells[block + 2] = 0;
+        if (head)
+            mCells[head + 2] = block;
+        head = block;
+    }
+    void unlink(long block) {
+        long next = mCells[block + 1];
+        long prev = mCells[block + 2];
+        if (prev)
+            mCells[prev + 1] = next;
+        else
+            mFreeLists[sizeClass(blockSize(block))] = next;
+        if (next)
+            mCells[next + 2] = prev;
+    }
 
+    //从空闲链表中取出一个至少有need个单元的块，剩余部分足够大时切分出去
+    long takeFree(long need) {
+        for (int c = sizeClass(need); c < kNumClasses; ++c) {
+            for (long block = mFreeLists[c]; block != 0; block = mCells[block + 1]) {
+                long size = blockSize(block);
+                if (size < need)
+                    continue;
+                unlink(block);
+                if (size - need >= kMinBlock + 2) {
+                    setTags(block, need, true);
+                    long rest = block + need + 2;
+                    setTags(rest, size - need - 2, false);
+                    insertFree(rest);
+                } else {
+                    setTags(block, size, true);
+                }
+                return block;
+            }
+        }
         return 0;
     }
 
-    //更新某个虚拟地址的实际地址
-    void UpdatePointer(long addr, Expr *expr) {
-        assert(mPointers.find(addr) != mPointers.end());
-        mPointers[addr] = expr;
+    //所有内存单元，使用long保证指针不溢出，指针中保存的地址也放在这里面
+    std::vector<long> mCells;
+    size_t mPeakCells;
+    HeapTracker *mTracker;
+    size_t mLimit;
+    bool mOverLimit;
+    //各级空闲链表的表头，0表示空
+    long mFreeLists[kNumClasses];
+};
+
+/* 栈内存：局部数组和被取地址的局部变量按调用顺序在堆中的大块里连续分配，
+ * 分配只移动栈顶，函数返回或语句块结束时栈顶退回到进入时记下的位置，不再逐块Malloc和Free。
+ * 块本身用Heap::Malloc分配，所以栈内存的地址与其它内存一样可以直接Get、Update和Data，
+ * 块分配后一直保留给后面的调用使用
+ */
+class StackRegion {
+public:
+    explicit StackRegion(Heap &heap) : mHeap(heap), mChunks(), mChunk(0), mTop(0) {}
+
+    StackMark mark() const {
+        StackMark mark = { mChunk, mTop };
+        return mark;
     }
 
-  private:
-    //保存分配的内存的首地址和大小
-    std::map<long, long> mBuffers;
-    //保存某内存地址的值，使用long保证指针不溢出，指针中保存的地址也放在这里面
-    std::map<long, long> mValues;
-    //指针地址映射表，将mValues中保存的指针地址映射为实际地址
-    std::map<long, Expr *> mPointers;
-    //尚未分配的最小地址
-    long min_addr;
+    //释放mark之后分配的内存，必须按分配的相反顺序释放
+    void release(StackMark mark) {
+        mChunk = mark.chunk;
+        mTop = mark.top;
+    }
+
+    //mark之后是否分配过内存
+    bool above(StackMark mark) const {
+        return mChunk != mark.chunk || mTop != mark.top;
+    }
+
+    //分配size个清零的单元，返回首地址
+    long alloc(long size) {
+        assert(size >= 0);
+        if (mChunks.empty() || mTop + size > mChunks[mChunk].size)
+            advance(size);
+        long addr = mChunks[mChunk].base + mTop;
+        mTop += size;
+        long *cells = mHeap.Data(addr, size);
+        std::fill(cells, cells + size, 0);
+        return addr;
+    }
+
+private:
+    //每块的单元数，比这大的数组单独占一块
+    static const long kChunkCells = 16 * 1024;
+
+    struct Chunk {
+        long base;      //块在堆中的首地址
+        long size;
+    };
+
+    //换到下一块，下一块不够大时换成足够大的新块
+    void advance(long size) {
+        size_t next = mChunks.empty() ? 0 : mChunk + 1;
+        if (next == mChunks.size() || mChunks[next].size < size) {
+            Chunk chunk;
+            chunk.size = std::max(kChunkCells, size);
+            chunk.base = mHeap.Malloc(chunk.size);
+            if (next < mChunks.size()) {
+                mHeap.Free(mChunks[next].base);
+                mChunks[next] = chunk;
+            }
+            else
+                mChunks.push_back(chunk);
+        }
+        mChunk = next;
+        mTop = 0;
+    }
+
+    Heap &mHeap;
+    std::vector<Chunk> mChunks;
+    size_t mChunk;      //栈顶所在的块
+    long mTop;          //栈顶在块中的位置
+};
+
+//变量的槽位，全局变量位于mGlobalVars中，其它变量位于当前栈帧中，
+//被取地址的变量(addressable)的槽位中存放的是它在内存中的地址
+struct VarSlot {
+    unsigned index;
+    bool global;
+    bool addressable;
+};
+
+/* 循环条件和迭代表达式的融合操作：i < n这样的比较和i++、i = i + 1这样的自增
+ * 在进入循环时识别一次，之后每轮直接读写变量的槽位，不再逐个节点遍历
+ */
+struct FusedOperand {
+    bool isVar;
+    VarSlot slot;       //isVar时为变量的槽位
+    long constant;      //否则为常量
+};
+
+struct FusedCond {
+    BinaryOperatorKind op;
+    FusedOperand lhs;
+    FusedOperand rhs;
+};
+
+struct FusedStep {
+    VarSlot slot;
+    long delta;
+};
+
+/* 循环惯用法：for (...; i < n; i++)的循环体只有一条语句，按下标i逐个处理int数组的元素：
+ * a[i] = v填充、a[i] = b[i]复制、a[i] = b[i] op c[i]逐元素运算、s = s + a[i]求和。
+ * 进入循环时检查一次边界和重叠，然后整个循环作为一次批量操作执行
+ */
+enum IdiomKind {
+    IDIOM_FILL,
+    IDIOM_COPY,
+    IDIOM_BINARY,
+    IDIOM_SUM
+};
+
+//惯用法的操作数：isArray时为数组元素b[i]，base中是存放首地址的变量，否则base是不变的int值
+struct IdiomOperand {
+    bool isArray;
+    FusedOperand base;
+};
+
+struct LoopIdiom {
+    IdiomKind kind;
+    FusedCond cond;         //i < n或i <= n
+    VarSlot target;         //被写的数组，求和时为累加变量
+    BinaryOperatorKind op;  //逐元素运算的+、-、*
+    IdiomOperand lhs;       //填充的值、复制或求和的数组、运算的左操作数
+    IdiomOperand rhs;       //运算的右操作数
+};
+
+//函数的栈帧布局，同时记录函数的执行次数，用来决定是否编译为本地代码
+struct FrameLayout {
+    unsigned size;                      //槽位个数
+    std::vector<unsigned> addressable;  //被取地址的变量的槽位
+    FunctionDecl *definition;           //函数的定义
+    unsigned long calls;                //调用次数
+    unsigned long backedges;            //循环回边的执行次数
+    void *native;                       //本地代码的入口，NULL表示解释执行
+    bool jitFailed;                     //函数不能编译为本地代码，不再尝试
+};
+
+/* ASTContext中的类型大小等信息在第一次查询时计算并缓存，这些缓存不是线程安全的。
+ * 批量执行时多个线程共享同一棵语法树，编译字节码和本地代码、通过SourceManager查源代码位置时要持有这个锁
+ */
+static std::mutex &astContextMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+//执行统计，用于--stats
+struct ExecStats {
+    unsigned long nodes;            //遍历语法树时执行的语句和求值的表达式个数
+    unsigned long instructions;     //字节码模式下执行的指令条数
+    unsigned long calls;            //用户函数的调用次数
+    size_t heapCells;               //程序结束时堆缓冲区的单元数
+    size_t heapPeakCells;           //堆缓冲区曾经达到的最大单元数
+    size_t framePeakDepth;          //同时存在的栈帧数的最大值
+    size_t framePeakBytes;          //栈帧槽位曾经占用的最大字节数
+    size_t frameReservedBytes;      //为栈帧槽位分配的字节数
+};
+
+/* 执行预算，0表示不限制。步数是循环回边和函数调用的次数，堆的预算是堆缓冲区的单元数，
+ * 包括栈内存和全局变量
+ */
+struct ExecBudget {
+    unsigned long steps;
+    unsigned long millis;
+    size_t cells;
+};
+
+//本地代码编译器的接口，实现见jit.hpp，Environment只负责计数和分派
+class NativeCompiler {
+public:
+    virtual ~NativeCompiler() {}
+
+    //编译函数，返回本地代码的入口，不能编译时返回NULL
+    virtual void *compile(FunctionDecl *fdecl) = 0;
+
+    //本地代码的参数都是int，最多支持的参数个数
+    static const unsigned kMaxParams = 4;
 };
 
 class Environment {
 private:
     //保存当前栈上的变量
     std::vector<StackFrame> mStack;
-    //保存全局变量，所有栈帧以它为模板进行创建，每次撤销栈帧也要将全局变量的值更新一次
-    StackFrame mGlobalVars;
+    //保存全局变量，所有栈帧直接引用这里的值，函数调用和返回都不需要复制全局变量
+    std::vector<long> mGlobalVars;
+    //所有栈帧的槽位
+    FrameArena mFrameArena;
+    //每个变量(包括参数)的槽位，由init预先计算
+    llvm::DenseMap<const Decl *, VarSlot> mSlots;
+    //每个函数(规范声明)的栈帧布局，init之后不再插入，栈帧中保存的布局指针一直有效
+    llvm::DenseMap<const FunctionDecl *, FrameLayout> mLayouts;
     //保存分配的内存
     Heap mHeap;
+    //局部数组和被取地址的局部变量所在的栈内存，位于mHeap中
+    StackRegion mStackRegion;
+    /* 操作数栈，保存表达式的中间结果：子表达式求值后把结果压栈，父表达式弹出使用，
+     * 每条语句执行完后恢复到执行前的高度，值的类型设为long，保证保存地址时不溢出
+     */
+    std::vector<long> mOperands;
+    //被调函数的返回值，由afterCall压入调用者的操作数栈
+    long mRetVal;
+    //主函数的返回值，作为程序的退出状态
+    int mExitCode;
+    ExecStats mStats;
+    //内建函数get和print的输入输出
+    ProgramIO *mIO;
+    //本地代码编译器，NULL表示不使用JIT
+    NativeCompiler *mJit;
+    //调用次数与循环回边次数之和达到这个值时编译函数
+    unsigned long mJitThreshold;
+    //最大调用深度，超过时程序以栈溢出终止
+    size_t mMaxDepth;
+    //程序因错误被终止时的原因，为空表示正常执行
+    std::string mTrap;
+    //程序被终止时的退出状态，以及终止的位置，NULL表示不确定
+    int mTrapCode;
+    const Stmt *mTrapSite;
+    //执行预算，已经执行的步数，步数到达mNextCheck时才检查各项预算
+    ExecBudget mBudget;
+    unsigned long mSteps;
+    unsigned long mNextCheck;
+    std::chrono::steady_clock::time_point mBudgetStart;
+    //尾调用已经替换了当前栈帧，等待执行的被调函数
+    FunctionDecl *mTailCallee;
 
-    /// Declartions to the built-in functions
-    FunctionDecl *mFree;
-    FunctionDecl *mMalloc;
-    FunctionDecl *mInput;
-    FunctionDecl *mOutput;
+    //没有定义的函数(规范声明)绑定的本地实现在mNatives中的下标，包括内建函数
+    llvm::DenseMap<const FunctionDecl *, unsigned> mNativeIndex;
+    std::vector<NativeBinding> mNatives;
     FunctionDecl *mEntry;
+    //每个运算和类型转换按静态类型选好的运算，第一次求值时选择
+    llvm::DenseMap<const Expr *, ExprKernels> mKernels;
+    //REPL求值全局变量的初始值时使用的空栈帧布局
+    FrameLayout mScratchLayout;
 public:
     /// Get the declartions to the built-in functions
-    Environment() : mStack(), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL), mEntry(NULL) {
+    Environment() : mStack(), mGlobalVars(), mFrameArena(), mSlots(), mLayouts(), mHeap(), mStackRegion(mHeap), mOperands(), mRetVal(0), mExitCode(0), mStats(), mIO(&ConsoleIO::instance()), mJit(NULL), mJitThreshold(0), mMaxDepth(kDefaultMaxDepth), mTrap(), mTrapCode(kTrapExitCode), mTrapSite(NULL), mBudget(), mSteps(0), mNextCheck(ULONG_MAX), mBudgetStart(), mTailCallee(NULL), mNativeIndex(), mNatives(), mEntry(NULL), mKernels(), mScratchLayout() {
+        mOperands.reserve(1024);
     }
 
 
     /// Initialize the Environment
     void init(TranslationUnitDecl *unit) {
 		for (TranslationUnitDecl::decl_iterator i =unit->decls_begin(), e = unit->decls_end(); i != e; ++ i) {
-            //识别内建函数和主函数
+            //识别主函数，没有定义的函数绑定到本地实现
 			if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i) ) {
-				if (fdecl->getName().equals("free")) mFree = fdecl;
-				else if (fdecl->getName().equals("malloc")) mMalloc = fdecl;
-				else if (fdecl->getName().equals("get")) mInput = fdecl;
-				else if (fdecl->getName().equals("print")) mOutput = fdecl;
-				else if (fdecl->getName().equals("main")) mEntry = fdecl;
+				if (fdecl->getName().equals("main")) mEntry = fdecl;
+				else if (!fdecl->hasBody()) bindNative(fdecl);
 			}
-            //处理全局变量，必须以字面值常量初始化，不能以表达式或变量进行初始化
+            //处理全局变量，必须以常量表达式初始化，不能以变量进行初始化
             if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
-                int val = 0;
+                unsigned slot = declareGlobal(vdecl);
                 if (!(vdecl->hasInit())) {  //未初始化的初始化为0
                     if (!(vdecl->getType()->isArrayType()))   //不是数组类型的绑定为0
-                        mGlobalVars.bindDecl(vdecl, 0);
+                        mGlobalVars[slot] = 0;
                     else {
                         //将类型转为字符串(形如int [10])，从里面分析出下标大小
                         //TODO:有没有更优雅的方法呢？
@@ -214,18 +700,179 @@ public:
 					
 						//分配内存并保存首地址
 						long buf = mHeap.Malloc(size);
-                        mGlobalVars.bindDecl(vdecl, buf);
+                        mGlobalVars[slot] = buf;
                     }
                 }
-                else {  //有初始值的，只处理整型变量
-                    IntegerLiteral *integer = dyn_cast<IntegerLiteral>(vdecl->getInit());
-                    val = integer->getValue().getSExtValue();
-                    mGlobalVars.bindDecl(vdecl, val);
+                else {  //有初始值的，按变量的类型求出常量的值，求值会用到ASTContext的缓存
+                    std::lock_guard<std::mutex> lock(astContextMutex());
+                    mGlobalVars[slot] = constantWord(vdecl->getASTContext(), vdecl->getInit());
                 }
             }
         }
 
-		mStack.push_back(mGlobalVars);
+        //全局变量的槽位确定之后，再为每个函数的参数和局部变量分配槽位
+        llvm::DenseSet<const VarDecl *> addr_taken;
+        for (TranslationUnitDecl::decl_iterator i =unit->decls_begin(), e = unit->decls_end(); i != e; ++ i)
+            if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i))
+                if (fdecl->doesThisDeclarationHaveABody())
+                    layoutFrame(fdecl, addr_taken);
+
+        //被取地址的全局变量搬到内存中，槽位中改存它的地址
+        for (const VarDecl *vdecl : addr_taken) {
+            if (vdecl->hasLocalStorage())
+                continue;
+            VarSlot slot = slotOf(vdecl);
+            if (slot.addressable)
+                continue;
+            long addr = mHeap.Malloc(1);
+            mHeap.Update(addr, mGlobalVars[slot.index]);
+            mGlobalVars[slot.index] = addr;
+            for (const VarDecl *redecl : vdecl->redecls())
+                mSlots[redecl].addressable = true;
+        }
+
+        //主函数直接在栈底的栈帧中执行
+		mStack.push_back(makeFrame(mEntry));
+    }
+
+    //为全局变量分配槽位，同一变量的多次声明共用一个槽位
+    unsigned declareGlobal(VarDecl *vdecl) {
+        auto it = mSlots.find(vdecl->getCanonicalDecl());
+        if (it != mSlots.end()) {
+            mSlots[vdecl] = it->second;
+            return it->second.index;
+        }
+        VarSlot slot = { (unsigned)mGlobalVars.size(), true, false };
+        mGlobalVars.push_back(0);
+        mSlots[vdecl->getCanonicalDecl()] = slot;
+        mSlots[vdecl] = slot;
+        return slot.index;
+    }
+
+    //计算函数的栈帧布局：依次是参数和局部变量，被取地址的变量记入addr_taken
+    void layoutFrame(FunctionDecl *fdecl, llvm::DenseSet<const VarDecl *> &addr_taken) {
+        Stmt *body = fdecl->getBody();
+        AddrTakenFinder(addr_taken).TraverseStmt(body);
+
+        std::vector<VarDecl *> vars(fdecl->param_begin(), fdecl->param_end());
+        LocalVarFinder(vars).TraverseStmt(body);
+
+        FrameLayout &layout = mLayouts[fdecl->getCanonicalDecl()];
+        layout.size = vars.size();
+        layout.definition = fdecl;
+        for (unsigned i = 0; i < vars.size(); ++i) {
+            VarSlot slot = { i, false, addr_taken.count(vars[i]) != 0 };
+            mSlots[vars[i]] = slot;
+            if (slot.addressable)
+                layout.addressable.push_back(i);
+        }
+    }
+
+    //按布局一次分配整个栈帧，被取地址的变量在栈内存中占用一个连续的块
+    StackFrame makeFrame(FunctionDecl *fdecl) {
+        return makeFrame(mLayouts.find(fdecl->getCanonicalDecl())->second);
+    }
+    StackFrame makeFrame(FrameLayout &layout) {
+        StackFrame frame;
+        unsigned chunk;
+        frame.setSlots(mFrameArena.push(layout.size, chunk), layout.size, chunk);
+        frame.setLayout(&layout);
+        frame.setStackMark(mStackRegion.mark());
+        if (!layout.addressable.empty()) {
+            long memory = mStackRegion.alloc(layout.addressable.size());
+            for (unsigned i = 0; i < layout.addressable.size(); ++i)
+                frame.bindSlot(layout.addressable[i], memory + i);
+            afterAlloc();
+        }
+        return frame;
+    }
+
+    /* REPL：语法树随输入逐步增长，每个新的顶层声明解析后单独登记，全局变量、堆和本地函数的绑定
+     * 在各次输入之间保留。之后的输入可能取任何全局变量的地址，所以REPL的全局变量都放在内存中。
+     * 登记会插入新的布局，只能在两次输入之间进行，这时没有栈帧引用布局
+     */
+    void declare(Decl *decl) {
+        if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl)) {
+            if (fdecl->doesThisDeclarationHaveABody()) {
+                //先声明后定义的函数不再调用本地实现
+                mNativeIndex.erase(fdecl->getCanonicalDecl());
+                llvm::DenseSet<const VarDecl *> addr_taken;
+                layoutFrame(fdecl, addr_taken);
+            }
+            else if (!fdecl->hasBody())
+                bindNative(fdecl);
+            return ;
+        }
+        VarDecl *vdecl = dyn_cast<VarDecl>(decl);
+        if (!vdecl)
+            return ;
+        //同一变量的再次声明共用已经分配的内存
+        bool declared = mSlots.count(vdecl->getCanonicalDecl()) != 0;
+        unsigned slot = declareGlobal(vdecl);
+        if (declared)
+            return ;
+        if (const ConstantArrayType *array = vdecl->getASTContext().getAsConstantArrayType(vdecl->getType())) {
+            mGlobalVars[slot] = mHeap.Malloc(array->getSize().getZExtValue());
+            return ;
+        }
+        mGlobalVars[slot] = mHeap.Malloc(1);
+        mSlots[vdecl->getCanonicalDecl()].addressable = true;
+        mSlots[vdecl].addressable = true;
+    }
+
+    //REPL：压入执行一次输入的栈帧，fdecl为NULL时压入没有变量的栈帧，用于求值全局变量的初始值
+    void enterEntry(FunctionDecl *fdecl) {
+        mStack.push_back(fdecl ? makeFrame(fdecl) : makeFrame(mScratchLayout));
+        mRetVal = 0;
+    }
+    //弹出输入的栈帧，丢弃剩余的操作数，清除终止的原因，之后的输入照常执行
+    void leaveEntry() {
+        releaseOperands(0);
+        releaseFrame(mStack.back());
+        mStack.pop_back();
+        mTailCallee = NULL;
+        mTrap.clear();
+        mTrapCode = kTrapExitCode;
+        mTrapSite = NULL;
+    }
+    //最近一次返回的值，REPL据此显示表达式的值
+    long getRetVal() {
+        return mRetVal;
+    }
+
+    //取得变量的槽位
+    VarSlot slotOf(const Decl *decl) {
+        auto it = mSlots.find(decl);
+        assert(it != mSlots.end());
+        return it->second;
+    }
+
+    //读写变量，全局变量直接访问共享的全局变量表，被取地址的变量访问内存
+    long getVar(Decl *decl) {
+        return loadSlot(slotOf(decl));
+    }
+    void setVar(Decl *decl, long val) {
+        storeSlot(slotOf(decl), val);
+    }
+    long loadSlot(VarSlot slot) {
+        long val = slot.global ? mGlobalVars[slot.index]
+                               : mStack.back().getSlotVal(slot.index);
+        return slot.addressable ? mHeap.Get(val) : val;
+    }
+    void storeSlot(VarSlot slot, long val) {
+        long &cell = slot.global ? mGlobalVars[slot.index] : mStack.back().slots()[slot.index];
+        if (slot.addressable)
+            mHeap.Update(cell, val);
+        else
+            cell = val;
+    }
+
+    //变量的地址，只有被取地址的变量才在内存中，数组的地址就是首地址
+    long addressOf(Decl *decl) {
+        VarSlot slot = slotOf(decl);
+        assert(slot.addressable || cast<ValueDecl>(decl)->getType()->isArrayType());
+        return slot.global ? mGlobalVars[slot.index]
+                           : mStack.back().getSlotVal(slot.index);
     }
 
     //主函数入口
@@ -233,377 +880,1011 @@ public:
 		return mEntry;
     }
 
-    /// 二元操作：=、+、-、*、/、%、比较
+    //字节码模式与树遍历模式共用同一个堆
+    Heap &getHeap() {
+        return mHeap;
+    }
+    //以及堆中的栈内存
+    StackRegion &getStackRegion() {
+        return mStackRegion;
+    }
+    //统计堆的分配和释放，用于--heap-report
+    void setHeapTracker(HeapTracker *tracker) {
+        mHeap.setTracker(tracker);
+    }
+
+    /* 语句块结束时释放块内声明的数组，循环体内的数组每轮都分配在同一个位置。
+     * 块以return结束时不释放，由函数返回时释放整个栈帧的栈内存
+     */
+    StackMark markStack() {
+        return mStackRegion.mark();
+    }
+    void releaseStack(StackMark mark) {
+        mStackRegion.release(mark);
+    }
+
+    //当前函数是否在栈内存中有数组或变量，有时实参可能指向它们，不能做尾调用
+    bool hasStackMemory() {
+        return mStackRegion.above(mStack.back().getStackMark());
+    }
+
+    //取得全局变量槽位中的值：初始值，被取地址的全局变量则是它所在的内存地址
+    long getGlobalVal(Decl *decl) {
+        return mGlobalVars[slotOf(decl).index];
+    }
+
+    //内建函数get和print的输入输出，解释执行和本地代码共用
+    void setIO(ProgramIO *io) {
+        mIO = io;
+    }
+    int input() {
+        return mIO->read();
+    }
+    void output(int val) {
+        mIO->write(val);
+    }
+
+    /* 本地函数注册表，进程内共享。首次使用时登记内建函数get、print、malloc、free
+     * 和kernels.h中声明的数组函数，--native-lib指定的库在执行任何程序之前加入
+     */
+    static NativeRegistry &natives() {
+        static NativeRegistry *registry = newRegistry();
+        return *registry;
+    }
+
+    //函数在本地函数表中的下标，不是没有定义的函数时返回-1
+    int nativeIndex(const FunctionDecl *fdecl) {
+        auto it = mNativeIndex.find(fdecl->getCanonicalDecl());
+        return it == mNativeIndex.end() ? -1 : (int)it->second;
+    }
+    const NativeBinding &getNative(unsigned index) {
+        return mNatives[index];
+    }
+
+    //以args为实参调用本地函数，没有找到实现时终止程序
+    long callBinding(unsigned index, const long *args) {
+        const NativeBinding &binding = mNatives[index];
+        if (!binding.isBound()) {
+            trap(binding.error);
+            return 0;
+        }
+        return binding.invoke(*this, args);
+    }
+
+    /* 内建函数，指针参数是堆单元的编号 */
+    static long builtinGet(Environment &env, const long *) {
+        return env.input();
+    }
+    static long builtinPrint(Environment &env, const long *args) {
+        env.output(args[0]);
+        return 0;
+    }
+    static long builtinMalloc(Environment &env, const long *args) {
+        //按int分配，如果是指针数组，则后面一半无用。调用位置是当前栈帧正在执行的调用
+        return env.allocate((int)args[0] / sizeof(int), env.mStack.back().getPC());
+    }
+    static long builtinFree(Environment &env, const long *args) {
+        env.mHeap.Free(args[0]);
+        return 0;
+    }
+    //sort_ints(a, n)：把a[0..n)按int升序排列
+    static long builtinSortInts(Environment &env, const long *args) {
+        long *data = env.mHeap.Data(args[0], args[1]);
+        if (!data) {
+            env.trap("sort_ints: invalid array");
+            return 0;
+        }
+        std::sort(data, data + args[1], [](long a, long b) {
+            return (int)a < (int)b;
+        });
+        return 0;
+    }
+    //hash_ints(a, n)：a[0..n)的32位FNV-1a散列值
+    static long builtinHashInts(Environment &env, const long *args) {
+        long *data = env.mHeap.Data(args[0], args[1]);
+        if (!data) {
+            env.trap("hash_ints: invalid array");
+            return 0;
+        }
+        uint32_t hash = 2166136261u;
+        for (long i = 0; i < args[1]; ++i) {
+            uint32_t val = (uint32_t)(int)data[i];
+            for (int byte = 0; byte < 4; ++byte) {
+                hash = (hash ^ (val & 0xff)) * 16777619u;
+                val >>= 8;
+            }
+        }
+        return (int)hash;
+    }
+
+    //执行统计，执行过程中直接累加计数
+    ExecStats &getStats() {
+        return mStats;
+    }
+    //程序结束时的统计，同时填入堆的单元数
+    ExecStats finalStats() {
+        mStats.heapCells = mHeap.cells();
+        mStats.heapPeakCells = mHeap.peakCells();
+        //字节码模式的栈帧由BytecodeVM记录，取两者中较大的
+        mStats.framePeakDepth = std::max(mStats.framePeakDepth, mFrameArena.peakDepth());
+        mStats.framePeakBytes = std::max(mStats.framePeakBytes, mFrameArena.peakBytes());
+        mStats.frameReservedBytes = std::max(mStats.frameReservedBytes, mFrameArena.reservedBytes());
+        return mStats;
+    }
+
+    //程序的退出状态，即主函数的返回值
+    void setExitCode(int code) {
+        mExitCode = code;
+    }
+    int getExitCode() {
+        if (isTrapped())
+            return mTrapCode;
+        return mExitCode;
+    }
+
+    //默认的最大调用深度，两种执行方式的栈帧都在堆上，深度只受内存限制
+    static const size_t kDefaultMaxDepth = 1000000;
+    //程序被解释器终止时的退出状态，与EX_SOFTWARE相同
+    static const int kTrapExitCode = 70;
+    //程序超出执行预算时的退出状态，与timeout命令相同
+    static const int kBudgetExitCode = 124;
+
+    void setMaxDepth(size_t depth) {
+        mMaxDepth = depth;
+    }
+    size_t getMaxDepth() {
+        return mMaxDepth;
+    }
+
+    /* 终止程序，例如栈溢出。之后的函数调用都不再执行，值为0，树遍历在当前语句结束后
+     * 逐层退出，字节码解释循环直接返回，原因由getTrap取得
+     */
+    void trap(const std::string &reason, int code = kTrapExitCode, const Stmt *site = NULL) {
+        if (!mTrap.empty())
+            return ;
+        mTrap = reason;
+        mTrapCode = code;
+        mTrapSite = site;
+    }
+    bool isTrapped() {
+        return !mTrap.empty();
+    }
+    const std::string &getTrap() {
+        return mTrap;
+    }
+    const Stmt *getTrapSite() {
+        return mTrapSite;
+    }
+
+    /* 执行预算：只在循环回边和函数调用时记一步，平时只有一次自增和比较，
+     * 每kCheckInterval步才检查步数、墙钟时间和堆，超出时以kBudgetExitCode终止程序
+     */
+    void setBudget(const ExecBudget &budget) {
+        mBudget = budget;
+        mHeap.setLimit(budget.cells);
+        mSteps = 0;
+        mBudgetStart = std::chrono::steady_clock::now();
+        mNextCheck = nextCheck();
+    }
+    bool hasBudget() {
+        return mBudget.steps || mBudget.millis || mBudget.cells;
+    }
+
+    //记一步，site为循环语句或者调用，程序已被终止时返回false
+    bool tick(const Stmt *site) {
+        if (++mSteps < mNextCheck)
+            return true;
+        return checkBudget(site);
+    }
+
+    //程序调用malloc，超出堆的预算时终止程序并返回空指针
+    long allocate(long size, const Stmt *site) {
+        long addr = mHeap.Malloc(size, site);
+        if (!addr)
+            checkBudget(site);
+        return addr;
+    }
+
+    //解释器为栈帧和数组分配内存之后，堆超出预算时让下一步立即检查
+    void afterAlloc() {
+        if (mHeap.overLimit())
+            mNextCheck = 0;
+    }
+
+    /* 遍历语法树时宿主栈的下界：语句和表达式嵌套很深时，不到最大调用深度也可能用完宿主栈，
+     * 所以调用和求值时检查栈顶是否已经低于下界，低于时以栈溢出终止，而不是碰到保护页崩溃。
+     * 由runOnLargeStack为执行的线程设置，NULL表示不检查
+     */
+    static const char *&stackLimit() {
+        static thread_local const char *limit = NULL;
+        return limit;
+    }
+    static bool hostStackLow() {
+        return static_cast<const char *>(__builtin_frame_address(0)) < stackLimit();
+    }
+    void trapHostStack() {
+        trap("stack overflow: statements, expressions or calls nest too deeply for the interpreter stack");
+    }
+
+    //当前线程正在执行的Environment，本地代码调用内建函数时通过它回到解释器
+    static Environment *&current() {
+        static thread_local Environment *env = NULL;
+        return env;
+    }
+
+    /* 分层执行：函数先解释执行，调用次数与循环回边次数之和达到阈值后编译为本地代码，
+     * 之后的调用直接执行本地代码。循环回边只影响下一次调用，正在执行的调用不会切换
+     */
+    void setJit(NativeCompiler *jit, unsigned long threshold) {
+        mJit = jit;
+        mJitThreshold = threshold;
+    }
+    bool hasJit() {
+        return mJit != NULL;
+    }
+
+    //记录一次循环回边，超出执行预算时返回false
+    bool backEdge(Stmt *loop) {
+        ++mStack.back().getLayout()->backedges;
+        return tick(loop);
+    }
+
+    //函数定义的栈帧布局，字节码执行时用它记录循环回边
+    FrameLayout *getLayout(const FunctionDecl *fdecl) {
+        return &mLayouts.find(fdecl->getCanonicalDecl())->second;
+    }
+
+    //记录一次调用，返回函数的本地代码，仍需解释执行时返回NULL
+    void *enterNative(FunctionDecl *fdecl) {
+        if (!mJit)
+            return NULL;
+        auto it = mLayouts.find(fdecl->getCanonicalDecl());
+        if (it == mLayouts.end())
+            return NULL;
+        FrameLayout &layout = it->second;
+        ++layout.calls;
+        if (!layout.native && !layout.jitFailed &&
+                layout.calls + layout.backedges >= mJitThreshold) {
+            layout.native = mJit->compile(layout.definition);
+            layout.jitFailed = !layout.native;
+        }
+        return layout.native;
+    }
+
+    //以args为实参调用本地代码，返回值按int处理，void函数返回0
+    long callNative(void *code, FunctionDecl *fdecl, const long *args) {
+        int argv[NativeCompiler::kMaxParams] = { 0 };
+        unsigned num_args = fdecl->getNumParams();
+        assert(num_args <= NativeCompiler::kMaxParams);
+        for (unsigned i = 0; i < num_args; ++i)
+            argv[i] = args[i];
+
+        Environment *saved = current();
+        current() = this;
+        long val = 0;
+        if (fdecl->getReturnType()->isVoidType())
+            invokeNative<void>(code, num_args, argv);
+        else
+            val = invokeNative<int>(code, num_args, argv);
+        current() = saved;
+        return val;
+    }
+
+    template <typename R>
+    static R invokeNative(void *code, unsigned num_args, const int *argv) {
+        switch (num_args) {
+        case 0:
+            return reinterpret_cast<R (*)()>(code)();
+        case 1:
+            return reinterpret_cast<R (*)(int)>(code)(argv[0]);
+        case 2:
+            return reinterpret_cast<R (*)(int, int)>(code)(argv[0], argv[1]);
+        case 3:
+            return reinterpret_cast<R (*)(int, int, int)>(code)(argv[0], argv[1], argv[2]);
+        default:
+            return reinterpret_cast<R (*)(int, int, int, int)>(code)(argv[0], argv[1], argv[2], argv[3]);
+        }
+    }
+
+    /* 操作数栈接口，表达式的值不再按语法树节点保存，子表达式的值在父表达式中弹出 */
+    void push(long val) {
+        ++mStats.nodes;     //每个表达式求值后恰好压入一个值
+        mOperands.push_back(val);
+    }
+    long pop() {
+        assert(!mOperands.empty());
+        long val = mOperands.back();
+        mOperands.pop_back();
+        return val;
+    }
+    //语句执行前记下操作数栈的高度，执行后丢弃语句求值留下的值
+    size_t markOperands() {
+        ++mStats.nodes;
+        return mOperands.size();
+    }
+    void releaseOperands(size_t mark) {
+        mOperands.resize(mark);
+    }
+
+    /// 二元操作：赋值、复合赋值、算术、位运算、比较、逻辑运算和逗号
+    /// 赋值时左边只对求地址所需的子表达式求值，栈上依次为：地址部分、右边的值
     void binop(BinaryOperator *bop) {
-		Expr *left = bop->getLHS();    //左操作数
-		Expr *right = bop->getRHS();   //右操作数
+		Expr *left = bop->getLHS()->IgnoreParens();    //左操作数
 
         //赋值
 		if (bop->isAssignmentOp()) {
-			long val = mStack.back().getStmtVal(right);
+			long val = pop();
+
+            //复合赋值先按地址读出左边原来的值，转换为计算类型后运算，结果再转换回左边的类型
+            if (bop->isCompoundAssignmentOp()) {
+                ExprKernels kernels = kernelsOf(bop);
+                long old = peekLValue(left);
+                if (kernels.widen)
+                    old = kernels.widen(old);
+                val = kernels.binary ? kernels.binary(old, val) : 0;
+                if (kernels.narrow)
+                    val = kernels.narrow(val);
+            }
 
             /* 处理左值表达式：指针和数组下标引用 */
             //指针
             if (isa<UnaryOperator>(left)) {
                 UnaryOperator *uop = dyn_cast<UnaryOperator>(left);
-                if (uop->getOpcode() == UO_Deref) { //确定是指针
-                    Expr *sub_expr = uop->getSubExpr();
-                    long addr = mStack.back().getStmtVal(sub_expr);
-                    mHeap.Update(addr, val);    //更新虚地址中的值
-                    //更新实际地址中的值
-                    if (Expr *expr = mHeap.getRealAddr(addr)) {
-                        DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(expr);
-                        Decl *decl = declexpr->getFoundDecl();
-                        mStack.back().bindDecl(decl, val);
-                    }
+                if (uop->getOpcode() == UO_Deref) { //确定是指针，被取地址的变量也在内存中，直接写入即可
+                    long addr = pop();
+                    mHeap.Update(addr, val);
                 }
             }
             //数组
             else if (isa<ArraySubscriptExpr>(left)) {
-                ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(left);
-                Expr *left_expr = array->getLHS();  //数组名
-                Expr *right_expr = array->getRHS(); //下标
-
-                long base = mStack.back().getStmtVal(left_expr);
-                long offset = mStack.back().getStmtVal(right_expr);
+                long offset = pop();
+                long base = pop();
                 mHeap.Update(base + offset, val);
             }
             //其它变量赋值，左边必为变量名，直接更新至变量引用表
             else if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(left)) {
                 Decl *decl = declexpr->getFoundDecl();
-                mStack.back().bindDecl(decl, val);
+                setVar(decl, val);
             }
 
             //整个表达式的值为赋值号右边的值，有了这个可以支持连等
-            mStack.back().bindStmt(bop, val);
+            push(val);
+            return ;
 		}
 
-        //加减法
-		//TODO:指针加减法，应该是可以了
-        else if (bop->isAdditiveOp()) {
-            long val1 = mStack.back().getStmtVal(left);
-            long val2 = mStack.back().getStmtVal(right);
-            if (bop->getOpcode() == BO_Add)         //+
-                mStack.back().bindStmt(bop, val1 + val2);
-            else if (bop->getOpcode() == BO_Sub)    //-
-                mStack.back().bindStmt(bop, val1 - val2);
-        }
-
-        //乘除法
-        else if (bop->isMultiplicativeOp()) {
-            int val1 = mStack.back().getStmtVal(left);
-            int val2 = mStack.back().getStmtVal(right);
-            if (bop->getOpcode() == BO_Mul)         //*
-                mStack.back().bindStmt(bop, val1 * val2);
-            else if (bop->getOpcode() == BO_Div)    //除
-                mStack.back().bindStmt(bop, val1 / val2);
-            else if (bop->getOpcode() == BO_Rem)    //%
-                mStack.back().bindStmt(bop, val1 % val2);
-        }
-
-        //比较操作符
-        else if (bop->isComparisonOp()) {
-            int val1 = mStack.back().getStmtVal(left);
-            int val2 = mStack.back().getStmtVal(right);
-            int result = 0;
-
-            switch (bop->getOpcode()) {
-            case BO_LT:     //<
-                result = val1 < val2;
-                break;
-            case BO_GT:     //>
-                result = val1 > val2;
-                break;
-            case BO_LE:     //<=
-                result = val1 <= val2;
-                break;
-            case BO_GE:     //>=
-                result = val1 >= val2;
-                break;
-            case BO_EQ:     //==
-                result = val1 == val2;
-                break;
-            case BO_NE:     //!=
-                result = val1 != val2;
-                break;
-            default:
-                ;
-            }
+        long rhs = pop();
+        long lhs = pop();
 
-            mStack.back().bindStmt(bop, result);
+        //逗号表达式的值为右边的值，左边可以是void
+        if (bop->getOpcode() == BO_Comma) {
+            push(rhs);
+            return ;
         }
 
-        //逻辑运算
-        else if (bop->isLogicalOp()) {
-            int val1 = mStack.back().getStmtVal(left);
-            int val2 = mStack.back().getStmtVal(right);
-            if (bop->getOpcode() == BO_LAnd)         //&&
-                mStack.back().bindStmt(bop, val1 && val2);
-            else if (bop->getOpcode() == BO_LOr)    //||
-                mStack.back().bindStmt(bop, val1 || val2);
-        }
+        //按操作数的类型选好的运算，不支持的类型(如结构体)得到0，保证操作数栈平衡
+        BinaryKernel kernel = kernelsOf(bop).binary;
+        push(kernel ? kernel(lhs, rhs) : 0);
+    }
+
+    //读出赋值左边原来的值，求地址所需的值仍留在操作数栈上
+    long peekLValue(Expr *left) {
+        if (isa<UnaryOperator>(left))
+            return mHeap.Get(mOperands.back());
+        if (isa<ArraySubscriptExpr>(left))
+            return mHeap.Get(mOperands[mOperands.size() - 2] + mOperands.back());
+        if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(left))
+            return getVar(declexpr->getFoundDecl());
+        return 0;
     }
 
-    //一元操作符，+、-、*
+    //表达式按静态类型选好的运算，每个表达式只选择一次
+    ExprKernels kernelsOf(const Expr *expr) {
+        auto it = mKernels.find(expr);
+        if (it != mKernels.end())
+            return it->second;
+        ExprKernels kernels = selectKernels(expr);
+        mKernels[expr] = kernels;
+        return kernels;
+    }
+
+    //一元操作符，++、--、+、-、~、!、*、&
     void unaryop(UnaryOperator *uop) {
         Expr *sub_expr = uop->getSubExpr();
-        long val = mStack.back().getStmtVal(sub_expr);  //操作数
-        long addr = 0;
+        if (uop->getOpcode() == UO_AddrOf) {    //取地址，栈上只有求地址所需的子表达式的值
+            addrOf(sub_expr->IgnoreParens());
+            return ;
+        }
+
+        long val = pop();  //操作数
         switch (uop->getOpcode())
         {
         case UO_PostInc:        //后置++
-            mStack.back().bindStmt(uop, val);
-            if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(sub_expr)) {
-				Decl *decl = declexpr->getFoundDecl();
-				mStack.back().bindDecl(decl, val + 1);
-			}
-            break;
         case UO_PostDec:        //后置--
-            mStack.back().bindStmt(uop, val);
-            if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(sub_expr)) {
-				Decl *decl = declexpr->getFoundDecl();
-				mStack.back().bindDecl(decl, val - 1);
-			}            
-            break;
         case UO_PreInc:         //前置++
-            mStack.back().bindStmt(uop, val + 1);
-            if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(sub_expr)) {
-				Decl *decl = declexpr->getFoundDecl();
-				mStack.back().bindDecl(decl, val + 1);
-			}
-            break;
-        case UO_PreDec:         //前置--
-            mStack.back().bindStmt(uop, val - 1);
-            if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(sub_expr)) {
+        case UO_PreDec: {       //前置--，按操作数的类型回绕，指针以堆单元为单位
+            UnaryKernel kernel = kernelsOf(uop).unary;
+            long updated = kernel ? kernel(val) : val;
+            push(uop->isPrefix() ? updated : val);
+            if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(sub_expr->IgnoreParens())) {
 				Decl *decl = declexpr->getFoundDecl();
-				mStack.back().bindDecl(decl, val - 1);
+				setVar(decl, updated);
 			}
             break;
+        }
         case UO_Plus:           //+
-            mStack.back().bindStmt(uop, val);
+            push(val);
             break;
         case UO_Minus:          //-
-            mStack.back().bindStmt(uop, -val);
-            break;
-        case UO_LNot:           //!
-            mStack.back().bindStmt(uop, !val);
+        case UO_Not:            //~
+        case UO_LNot: {         //!
+            UnaryKernel kernel = kernelsOf(uop).unary;
+            push(kernel ? kernel(val) : 0);
             break;
+        }
         case UO_Deref:          //访问指针所指的内存
-            mStack.back().bindStmt(uop, mHeap.Get(val));
-            break;
-        case UO_AddrOf:         //取地址
-            addr = mHeap.getImageAddr(sub_expr);
-            if (0 == addr) {
-                addr = mHeap.Malloc(1);     //TODO:撤销栈帧时内存泄露
-                mHeap.Update(addr, val);
-                mHeap.UpdatePointer(addr, sub_expr);
-            }
-            mStack.back().bindStmt(uop, addr);
+            push(mHeap.Get(val));
             break;
-        default:                //其它操作符暂不处理
-            ;
+        default:                //其它操作符暂不处理，保证操作数栈平衡
+            push(0);
         }
     }
 
-    //处理括号括起来的表达式
-    void paren(ParenExpr *paren_expr) {
-        Expr *sub_expr = paren_expr->getSubExpr();
-        long val = mStack.back().getStmtVal(sub_expr);
-        mStack.back().bindStmt(paren_expr, val);
+    //取地址：&a[i]为首地址加下标，&*p为p，&x为x在内存中的地址
+    void addrOf(Expr *expr) {
+        if (isa<ArraySubscriptExpr>(expr)) {
+            long offset = pop();
+            long base = pop();
+            push(base + offset);
+        }
+        else if (isa<UnaryOperator>(expr) && cast<UnaryOperator>(expr)->getOpcode() == UO_Deref) {
+            //p的值已经在栈顶
+        }
+        else if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(expr))
+            push(addressOf(declexpr->getFoundDecl()));
+        else
+            push(0);
     }
 
-    //实现sizeof操作符
-    //TODO:不能支持变量的sizeof操作，报段错误
+    //实现sizeof操作符，sizeof的操作数不求值
     void sizeOf(UnaryExprOrTypeTraitExpr *uett) {
-        int size;
+        int size = 0;
 
-        if (uett->getKind() == UETT_SizeOf) {
-            if (uett->getArgumentType()->isIntegerType())   //整数
-                size = sizeof(int);
-            else if (uett->getArgumentType()->isPointerType())  //指针
-                size = sizeof(int *);
-        }
+        if (uett->getKind() == UETT_SizeOf)
+            size = sizeOfType(uett->getTypeOfArgument());
 
-        mStack.back().bindStmt(uett, size);
+        push(size);
     }
 
     //处理数组，比如A[i]
     void array(ArraySubscriptExpr *array_expr) {
-        Expr *left = array_expr->getLHS();  //A
-        Expr *right = array_expr->getRHS(); //i
-        long base = mStack.back().getStmtVal(left);
-        long offset = mStack.back().getStmtVal(right);
+        long offset = pop();    //i
+        long base = pop();      //A
 
-        mStack.back().bindStmt(array_expr, mHeap.Get(base + offset));
+        push(mHeap.Get(base + offset));
     }
 
-    //取出语法树中的整数将它作为表达式插入到stack中
+    //取出语法树中的整数将它压入操作数栈，无符号类型零扩展
     void integerLiteral(IntegerLiteral *integer) {
-        int val = integer->getValue().getSExtValue();
-        mStack.back().bindStmt(integer, val);
-    }
-
-    //处理声明语句
-    void decl(DeclStmt *declstmt) {
-        //一条语句可能声明多个变量，所以需要遍历
-		for (DeclStmt::decl_iterator it = declstmt->decl_begin(), ie = declstmt->decl_end();
-				it != ie; ++ it) {
-			Decl *decl = *it;
-			if (VarDecl *vardecl = dyn_cast<VarDecl>(decl)) {
-                if (!(vardecl->hasInit())) {    //未初始化
-                    if (!(vardecl->getType()->isArrayType()))   //不是数组类型
-						mStack.back().bindDecl(vardecl, 0);
-                    else {  
-                        //将类型转为字符串(形如int [10])，从里面分析出下标大小
-                        //TODO:有没有更优雅的方法呢
-                        std::string type = (vardecl->getType()).getAsString();
-						int size = 0;
-						int indexLeft = type.find("[");
-						int indexRight = type.find("]");
-						if(((size_t)indexLeft != std::string::npos) && ((size_t)indexRight != std::string::npos))
-						{
-                            std::string num = type.substr(indexLeft + 1, indexRight - indexLeft - 1);
-							size = atoi(num.c_str());
-						}
-					
-						//分配内存并保存首地址，TODO:撤销栈帧时内存泄露
-						long buf = mHeap.Malloc(size);
-						mStack.back().bindDecl(vardecl, buf);
-                    }
+        const llvm::APInt &val = integer->getValue();
+        push(integer->getType()->isUnsignedIntegerType() ? (long)val.getZExtValue() : (long)val.getSExtValue());
+    }
+
+    //字符字面值，如'a'
+    void characterLiteral(CharacterLiteral *character) {
+        push(character->getValue());
+    }
+
+    //浮点数字面值，压入double的位模式
+    void floatingLiteral(FloatingLiteral *floating) {
+        push(Word<double>::make(floating->getValueAsApproximateDouble()));
+    }
+
+    //处理声明的变量，有初始值时初始值已经在操作数栈顶
+    void decl(VarDecl *vardecl) {
+        if (!(vardecl->hasInit())) {    //未初始化
+            if (!(vardecl->getType()->isArrayType()))   //不是数组类型
+                setVar(vardecl, 0);
+            else {
+                //将类型转为字符串(形如int [10])，从里面分析出下标大小
+                //TODO:有没有更优雅的方法呢
+                std::string type = (vardecl->getType()).getAsString();
+                int size = 0;
+                int indexLeft = type.find("[");
+                int indexRight = type.find("]");
+                if(((size_t)indexLeft != std::string::npos) && ((size_t)indexRight != std::string::npos))
+                {
+                    std::string num = type.substr(indexLeft + 1, indexRight - indexLeft - 1);
+                    size = atoi(num.c_str());
                 }
-				else if (vardecl->hasInit()) {	//有初始值
-					long val = mStack.back().getStmtVal(vardecl->getInit());
-					mStack.back().bindDecl(vardecl, val);
-				}
 
-			}
-		}
+                //在栈内存中分配并保存首地址，语句块结束或函数返回时释放
+                long buf = mStackRegion.alloc(size);
+                afterAlloc();
+                setVar(vardecl, buf);
+            }
+        }
+        else {	//有初始值
+            long val = pop();
+            setVar(vardecl, val);
+        }
     }
 
-	//将引用的变量的值放到栈上
+	//将引用的变量的值放到操作数栈上
     void declref(DeclRefExpr *declref) {
 		mStack.back().setPC(declref);
-        mStack.back().bindStmt(declref, 0); //默认初始化为0
 
-		//处理整型变量
-		if (declref->getType()->isIntegerType()) {
+		//整型、浮点型和指针变量，以及数组类型，变量中保存的字已经是按类型转换过的值
+		QualType type = declref->getType();
+		if (type->isIntegerType() || type->isRealFloatingType() || type->isPointerType() || type->isArrayType()) {
 			Decl *decl = declref->getFoundDecl();
-			int val = mStack.back().getDeclVal(decl);
-			mStack.back().bindStmt(declref, val);
-		}
-		//指针变量
-		else if (declref->getType()->isPointerType())
-		{
-			Decl *decl = declref->getFoundDecl();
-			long val = mStack.back().getDeclVal(decl);
-			mStack.back().bindStmt(declref, val);
-		}
-		//数组类型
-		else if (declref->getType()->isArrayType()) {
-			Decl *decl = declref->getFoundDecl();
-			long val = mStack.back().getDeclVal(decl);
-			mStack.back().bindStmt(declref, val);
+			long val = getVar(decl);
+			push(val);
 		}
+        //函数名等，默认为0
+        else
+            push(0);
     }
 
+    //类型转换，直接改写栈顶的值，左值到右值等不改变值的转换不需要处理
     void cast(CastExpr *castexpr) {
 		mStack.back().setPC(castexpr);
-		if (castexpr->getType()->isIntegerType()) {
-			Expr *expr = castexpr->getSubExpr();
-			int val = mStack.back().getStmtVal(expr);
-			mStack.back().bindStmt(castexpr, val);
-		}
-        else {  //保留扩展性
-            Expr *expr = castexpr->getSubExpr();
-			int val = mStack.back().getStmtVal(expr);
-			mStack.back().bindStmt(castexpr, val);
-        }
+        assert(!mOperands.empty());
+        if (!isValueCast(castexpr->getCastKind()))
+            return ;
+        if (UnaryKernel kernel = kernelsOf(castexpr).unary)
+            mOperands.back() = kernel(mOperands.back());
     }
 
-    //检查函数是否已经return，如果函数已经return，不能接着执行后面的语句
-    bool hasReturn() {
-        return mStack.back().getReturn();
+    /* 函数调用前设置环境，此时栈上依次为：函数名的值、各个实参的值
+     * 返回true表示已经压入新栈帧，需要解释执行函数体并调用afterCall；
+     * 内建函数和本地代码在这里直接执行完毕，返回值已经在操作数栈顶
+     */
+    bool call(CallExpr *callexpr) {
+		mStack.back().setPC(callexpr);
+		FunctionDecl *callee = callexpr->getDirectCallee();
+        unsigned num_args = callexpr->getNumArgs();
+        if (isTrapped() || !tick(callexpr))
+            return skipCall(num_args);
+        if (callDirect(callee, num_args))
+            return false;
+        if (mStack.size() >= mMaxDepth) {
+            trap("stack overflow: call depth exceeds " + std::to_string(mMaxDepth));
+            return skipCall(num_args);
+        }
+        if (hostStackLow()) {
+            trapHostStack();
+            return skipCall(num_args);
+        }
+
+        StackFrame stack = enterFrame(callee, num_args);
+        stack.setOperandBase(mOperands.size());
+        //把这一帧压入
+        mStack.push_back(stack);
+        mRetVal = 0;
+        ++mStats.calls;
+        return true;
     }
 
-    //函数调用前设置环境
-    void call(CallExpr *callexpr) {
+    /* return f(...)形式的尾调用，栈上同样是函数名和实参。被调函数的栈帧直接替换当前栈帧，
+     * 解释器退回到执行函数体的地方后由takeTailCall取得被调函数继续执行，
+     * 所以尾递归不会加深调用栈。内建函数和本地代码照常执行，返回false
+     */
+    bool tailCall(CallExpr *callexpr) {
 		mStack.back().setPC(callexpr);
 		FunctionDecl *callee = callexpr->getDirectCallee();
-		if (callee == mInput) {
-			llvm::errs() << "Please input an integer: ";
-            int val = 0;
-            std::cin >> val;
-            mStack.back().bindStmt(callexpr, val);
-        }
-        else if (callee == mOutput) {
-			Expr *decl = callexpr->getArg(0);
-			int val = mStack.back().getStmtVal(decl);
-			llvm::errs() << val << '\n';
-        }
-        else if (callee == mMalloc) {
-			Expr *decl = callexpr->getArg(0);
-			int val = mStack.back().getStmtVal(decl);
-            long buffer = mHeap.Malloc(val / sizeof(int));  //按int分配，如果是指针数组，则后面一半无用
-            mStack.back().bindStmt(callexpr, buffer);       //返回值
-        }
-        else if (callee == mFree) {
-            Expr *decl = callexpr->getArg(0);
-			long val = mStack.back().getStmtVal(decl);
-            mHeap.Free(val);
-        }
-        else {
-            //要继承全局变量
-            StackFrame stack = mGlobalVars;
-            //分析参数
-            auto pit = callee->param_begin();
-            for (auto ait = callexpr->arg_begin(), aie = callexpr->arg_end(); 
-                    ait != aie; ++ait, ++pit) {
-                int val = mStack.back().getStmtVal(*ait);
-                stack.bindDecl(*pit, val);
-            }
-            //设置这个函数为未返回过的
-            stack.setReturn(false);
-            //把这一帧压入
-            mStack.push_back(stack);
+        unsigned num_args = callexpr->getNumArgs();
+        if (isTrapped() || !tick(callexpr))
+            return skipCall(num_args);
+        if (callDirect(callee, num_args))
+            return false;
+
+        //实参已经在操作数栈上，先交还当前栈帧的槽位，被调函数的栈帧就分配在原来的位置
+        StackFrame &current = mStack.back();
+        size_t operand_base = current.getOperandBase();
+        releaseFrame(current);
+        StackFrame stack = enterFrame(callee, num_args);
+        releaseOperands(operand_base);
+        stack.setOperandBase(operand_base);
+        current = stack;
+        mTailCallee = callee->getDefinition();
+        mRetVal = 0;
+        ++mStats.calls;
+        return true;
+    }
+
+    //取得等待执行的尾调用的被调函数，没有尾调用时返回NULL
+    FunctionDecl *takeTailCall() {
+        FunctionDecl *callee = mTailCallee;
+        mTailCallee = NULL;
+        return callee;
+    }
+
+    //程序已被终止时不再执行调用，弹出实参和函数名，以0作为调用的值
+    bool skipCall(unsigned num_args) {
+        releaseOperands(mOperands.size() - num_args - 1);
+        push(0);
+        return false;
+    }
+
+    //本地函数(包括内建函数)和已编译为本地代码的函数直接执行，返回值压入操作数栈，其它函数返回false
+    bool callDirect(FunctionDecl *callee, unsigned num_args) {
+        auto it = mNativeIndex.find(callee->getCanonicalDecl());
+		if (it != mNativeIndex.end()) {
+            size_t args = mOperands.size() - num_args;
+            long val = callBinding(it->second, mOperands.data() + args);
+            releaseOperands(args - 1);  //弹出实参和函数名
+            push(val);
+        }
+        else if (void *code = enterNative(callee)) {
+            size_t args = mOperands.size() - num_args;
+            long val = callNative(code, callee, mOperands.data() + args);
+            releaseOperands(args - 1);  //弹出实参和函数名
+            push(val);
         }
+        else
+            return false;
+        return true;
     }
 
-    //处理返回语句
+    //按预先计算的布局一次分配被调函数的整个栈帧并绑定实参，实参和函数名从操作数栈上弹出
+    StackFrame enterFrame(FunctionDecl *callee, unsigned num_args) {
+        //全局变量是共享的，不需要复制
+        FunctionDecl *definition = callee->getDefinition();
+        FunctionDecl *params = definition ? definition : callee;
+        StackFrame stack = makeFrame(params);
+        //分析参数，参数的槽位在布局中已经确定，函数体引用的是定义处的参数
+        size_t args = mOperands.size() - num_args;
+        for (unsigned i = 0; i < num_args; ++i) {
+            long val = mOperands[args + i];
+            VarSlot slot = slotOf(params->getParamDecl(i));
+            if (slot.addressable)
+                mHeap.Update(stack.getSlotVal(slot.index), val);
+            else
+                stack.bindSlot(slot.index, val);
+        }
+        releaseOperands(args - 1);  //弹出实参和函数名
+        //设置这个函数为未返回过的
+        stack.setReturn(false);
+        return stack;
+    }
+
+    //处理返回语句，有返回值时返回值在操作数栈顶
     void ret(ReturnStmt *retstmt) {
         //取得返回值
-        Expr *ret_expr = retstmt->getRetValue();
-        int val = mStack.back().getStmtVal(ret_expr);
+        long val = retstmt->getRetValue() ? pop() : 0;
 
-        //返回值保存到上一个栈帧，主函数的返回值不作处理
+        //返回值暂存起来，由afterCall交给调用者，主函数的返回值作为退出状态
+        mRetVal = val;
         if (mStack.size() < 2)
-            return ;
-        Stmt *stmt = mStack[mStack.size() - 2].getPC(); //调用语句
-        mStack[mStack.size() - 2].bindStmt(stmt, val);
+            mExitCode = val;
 
         //设置这一个函数为返回了的
         mStack.back().setReturn(true);
     }
 
-    //函数调用之后重新设置环境
-    void afterCall(CallExpr *callexpr) {
-        FunctionDecl *callee = callexpr->getDirectCallee();
-        if (callee != mInput && callee != mOutput && callee != mMalloc && callee != mFree) {
-            //更新全局变量到全局变量表
-            for (auto i = mStack.back().mVars_begin(), e = mStack.back().mVars_end(); i != e; ++i)
-                if (mGlobalVars.mVars_find(i->first) != mGlobalVars.mVars_end())
-                    mGlobalVars.bindDecl(i->first, i->second);
+    //函数调用之后重新设置环境，只用于call压入了栈帧的调用
+    void afterCall(CallExpr *) {
+        //丢弃被调函数留在操作数栈上的值，再压入返回值
+        releaseOperands(mStack.back().getOperandBase());
+        releaseFrame(mStack.back());
+        mStack.pop_back();
+        push(mRetVal);
+    }
+
+    //释放栈帧的槽位和栈帧在栈内存中分配的数组和变量
+    void releaseFrame(StackFrame &frame) {
+        mStackRegion.release(frame.getStackMark());
+        mFrameArena.pop(frame.slots(), frame.size(), frame.getChunk());
+    }
 
-            //更新全局变量到上一个栈帧
-            for (auto i = mGlobalVars.mVars_begin(), e = mGlobalVars.mVars_end(); i != e; ++i)
-                mStack[mStack.size() - 2].bindDecl(i->first, i->second);
+    //计算条件表达式的值，条件表达式的值在操作数栈顶
+    bool caculateCond(Expr *cond) {
+        return pop();
+    }
 
-            mStack.pop_back();
+    /* 融合操作，识别失败时返回false，只接受int变量和int字面值，
+     * 运算的结果与逐个节点执行时相同：按int比较，自增自减按int回绕
+     */
+    bool fuseOperand(Expr *expr, FusedOperand &operand) {
+        expr = expr->IgnoreParens();
+        if (IntegerLiteral *integer = dyn_cast<IntegerLiteral>(expr)) {
+            if (!integer->getType()->isSpecificBuiltinType(BuiltinType::Int))
+                return false;
+            operand.isVar = false;
+            operand.constant = (int)integer->getValue().getSExtValue();
+            return true;
         }
+        ImplicitCastExpr *load = dyn_cast<ImplicitCastExpr>(expr);
+        if (!load || load->getCastKind() != CK_LValueToRValue)
+            return false;
+        DeclRefExpr *declref = dyn_cast<DeclRefExpr>(load->getSubExpr()->IgnoreParens());
+        if (!declref || !isa<VarDecl>(declref->getDecl()) || !declref->getType()->isSpecificBuiltinType(BuiltinType::Int))
+            return false;
+        operand.isVar = true;
+        operand.slot = slotOf(declref->getFoundDecl());
+        return true;
     }
 
-    //计算条件表达式的值
-    bool caculateCond(Expr *cond) {
-        return mStack.back().getStmtVal(cond);
+    bool fuseCond(Expr *cond, FusedCond &fused) {
+        BinaryOperator *bop = dyn_cast<BinaryOperator>(cond->IgnoreParens());
+        if (!bop || !bop->isComparisonOp())
+            return false;
+        fused.op = bop->getOpcode();
+        return fuseOperand(bop->getLHS(), fused.lhs) && fuseOperand(bop->getRHS(), fused.rhs);
+    }
+
+    //i++、++i、i--、--i、i = i + c、i = c + i、i = i - c
+    bool fuseStep(Expr *step, FusedStep &fused) {
+        step = step->IgnoreParens();
+        DeclRefExpr *target = NULL;
+        if (UnaryOperator *uop = dyn_cast<UnaryOperator>(step)) {
+            if (!uop->isIncrementDecrementOp())
+                return false;
+            target = dyn_cast<DeclRefExpr>(uop->getSubExpr()->IgnoreParens());
+            fused.delta = uop->isIncrementOp() ? 1 : -1;
+        }
+        else if (BinaryOperator *assign = dyn_cast<BinaryOperator>(step)) {
+            BinaryOperator *bop = dyn_cast<BinaryOperator>(assign->getRHS()->IgnoreParens());
+            if (assign->getOpcode() != BO_Assign || !bop || !bop->isAdditiveOp())
+                return false;
+            target = dyn_cast<DeclRefExpr>(assign->getLHS()->IgnoreParens());
+            FusedOperand lhs, rhs;
+            if (!target || !fuseOperand(bop->getLHS(), lhs) || !fuseOperand(bop->getRHS(), rhs))
+                return false;
+            if (bop->getOpcode() == BO_Add && !lhs.isVar)
+                std::swap(lhs, rhs);
+            if (!lhs.isVar || rhs.isVar || !sameSlot(lhs.slot, slotOf(target->getFoundDecl())))
+                return false;
+            fused.delta = bop->getOpcode() == BO_Add ? rhs.constant : -rhs.constant;
+        }
+        if (!target || !isa<VarDecl>(target->getDecl()) || !target->getType()->isSpecificBuiltinType(BuiltinType::Int))
+            return false;
+        fused.slot = slotOf(target->getFoundDecl());
+        return true;
+    }
+
+    bool testFused(const FusedCond &fused) {
+        ++mStats.nodes;
+        int lhs = fused.lhs.isVar ? loadSlot(fused.lhs.slot) : fused.lhs.constant;
+        int rhs = fused.rhs.isVar ? loadSlot(fused.rhs.slot) : fused.rhs.constant;
+        switch (fused.op) {
+        case BO_LT: return lhs < rhs;
+        case BO_GT: return lhs > rhs;
+        case BO_LE: return lhs <= rhs;
+        case BO_GE: return lhs >= rhs;
+        case BO_EQ: return lhs == rhs;
+        default:    return lhs != rhs;
+        }
+    }
+
+    void stepFused(const FusedStep &fused) {
+        ++mStats.nodes;
+        int val = loadSlot(fused.slot);
+        storeSlot(fused.slot, Arith<int>::add(val, (int)fused.delta));
+    }
+
+    //识别for循环的惯用法，条件和迭代表达式已经融合
+    bool fuseIdiom(ForStmt *forstmt, const FusedCond &cond, const FusedStep &step, LoopIdiom &idiom) {
+        if ((cond.op != BO_LT && cond.op != BO_LE) || !cond.lhs.isVar || step.delta != 1 ||
+                !sameSlot(cond.lhs.slot, step.slot) || cond.lhs.slot.addressable)
+            return false;
+        VarSlot index = cond.lhs.slot;
+        if (cond.rhs.isVar && (cond.rhs.slot.addressable || sameSlot(cond.rhs.slot, index)))
+            return false;
+        idiom.cond = cond;
+
+        Stmt *body = forstmt->getBody();
+        if (CompoundStmt *compound = dyn_cast<CompoundStmt>(body)) {
+            if (compound->size() != 1)
+                return false;
+            body = compound->body_front();
+        }
+        BinaryOperator *assign = dyn_cast<BinaryOperator>(body);
+        if (!assign)
+            return false;
+        Expr *rhs = assign->getRHS()->IgnoreParens();
+
+        //s = s + a[i]、s = a[i] + s、s += a[i]，累加变量不能是循环变量或上界
+        if (idiomVar(assign->getLHS(), idiom.target)) {
+            if (sameSlot(idiom.target, index) || (cond.rhs.isVar && sameSlot(idiom.target, cond.rhs.slot)))
+                return false;
+            idiom.kind = IDIOM_SUM;
+            if (assign->getOpcode() == BO_AddAssign)
+                return idiomOperand(rhs, index, idiom.lhs) && idiom.lhs.isArray;
+            BinaryOperator *add = dyn_cast<BinaryOperator>(rhs);
+            if (assign->getOpcode() != BO_Assign || !add || add->getOpcode() != BO_Add)
+                return false;
+            IdiomOperand sum;
+            if (!idiomOperand(add->getLHS(), index, sum) || !idiomOperand(add->getRHS(), index, idiom.lhs))
+                return false;
+            if (sum.isArray)
+                std::swap(sum, idiom.lhs);
+            return idiom.lhs.isArray && !sum.isArray && sum.base.isVar && sameSlot(sum.base.slot, idiom.target);
+        }
+
+        //a[i] = ...
+        FusedOperand target;
+        if (assign->getOpcode() != BO_Assign || !idiomElement(assign->getLHS(), index, target))
+            return false;
+        idiom.target = target.slot;
+        if (BinaryOperator *bop = dyn_cast<BinaryOperator>(rhs)) {
+            idiom.kind = IDIOM_BINARY;
+            idiom.op = bop->getOpcode();
+            if (idiom.op != BO_Add && idiom.op != BO_Sub && idiom.op != BO_Mul)
+                return false;
+            return idiomOperand(bop->getLHS(), index, idiom.lhs) && idiomOperand(bop->getRHS(), index, idiom.rhs) &&
+                   (idiom.lhs.isArray || idiom.rhs.isArray);
+        }
+        if (!idiomOperand(rhs, index, idiom.lhs))
+            return false;
+        idiom.kind = idiom.lhs.isArray ? IDIOM_COPY : IDIOM_FILL;
+        return true;
+    }
+
+    /* 批量执行整个循环，之后循环变量等于上界。一轮也不执行、数组越界、
+     * 写入的数组与读取的数组部分重叠或者步数的预算在循环中间用完时返回false，由调用者逐轮执行。
+     * 每轮与逐轮执行时一样记一步，执行完后超出其它预算时程序被终止，loop为报告的位置
+     */
+    bool runIdiom(const LoopIdiom &idiom, const Stmt *loop) {
+        long lo = (int)loadSlot(idiom.cond.lhs.slot);
+        long hi = (int)fusedValue(idiom.cond.rhs);
+        if (idiom.cond.op == BO_LE)
+            ++hi;
+        if (hi <= lo)
+            return false;
+        long count = hi - lo;
+        if (mBudget.steps && mSteps + count > mBudget.steps)
+            return false;
+
+        long *x = idiomData(idiom.lhs, lo, count);
+        long *y = idiom.kind == IDIOM_BINARY ? idiomData(idiom.rhs, lo, count) : NULL;
+        if ((idiom.lhs.isArray && !x) || (idiom.kind == IDIOM_BINARY && idiom.rhs.isArray && !y))
+            return false;
+        long *dst = NULL;
+        if (idiom.kind != IDIOM_SUM) {
+            dst = mHeap.Data(loadSlot(idiom.target) + lo, count);
+            if (!dst || !unaliased(dst, x, count) || !unaliased(dst, y, count))
+                return false;
+        }
+
+        switch (idiom.kind) {
+        case IDIOM_FILL:
+            bulkFill(dst, count, fusedValue(idiom.lhs.base));
+            break;
+        case IDIOM_COPY:
+            bulkCopy(dst, x, count);
+            break;
+        case IDIOM_BINARY:
+            bulkBinary(idiom.op, dst, x, x ? 0 : fusedValue(idiom.lhs.base), y, y ? 0 : fusedValue(idiom.rhs.base), count);
+            break;
+        case IDIOM_SUM:
+            storeSlot(idiom.target, bulkSum(x, count, loadSlot(idiom.target)));
+            break;
+        }
+        storeSlot(idiom.cond.lhs.slot, hi);
+        ++mStats.nodes;
+        mStack.back().getLayout()->backedges += count;
+        mSteps += count;
+        if (mSteps >= mNextCheck)
+            checkBudget(loop);
+        return true;
+    }
+
+    static bool sameSlot(VarSlot a, VarSlot b) {
+        return a.index == b.index && a.global == b.global;
+    }
+
+private:
+    //两次检查执行预算之间的步数，检查墙钟时间的开销分摊到每一步上可以忽略
+    static const unsigned long kCheckInterval = 1024;
+
+    //下一次检查的步数，步数的预算恰好在用完之后检查，没有预算时永远不检查
+    unsigned long nextCheck() {
+        if (!hasBudget())
+            return ULONG_MAX;
+        unsigned long next = mSteps + kCheckInterval;
+        if (mBudget.steps && mBudget.steps < next)
+            next = mBudget.steps + 1;
+        return next;
+    }
+
+    //检查各项预算，超出时终止程序，之后每一步都返回false
+    bool checkBudget(const Stmt *site) {
+        if (isTrapped())
+            return false;
+        unsigned long millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - mBudgetStart).count();
+        std::string exceeded;
+        if (mBudget.steps && mSteps > mBudget.steps)
+            exceeded = "step limit of " + std::to_string(mBudget.steps) + " steps";
+        else if (mHeap.overLimit())
+            exceeded = "heap limit of " + std::to_string(mBudget.cells) + " cells";
+        else if (mBudget.millis && millis >= mBudget.millis)
+            exceeded = "time limit of " + std::to_string(mBudget.millis) + " ms";
+        if (exceeded.empty()) {
+            mNextCheck = nextCheck();
+            return true;
+        }
+        trap(exceeded + " exceeded after " + std::to_string(mSteps) + " steps, " + std::to_string(millis) +
+             " ms, " + std::to_string(mHeap.cells()) + " heap cells", kBudgetExitCode, site);
+        mNextCheck = 0;
+        return false;
+    }
+
+    //不被取地址的int变量本身(赋值的左边)，被取地址的变量可能被数组元素的写入改变
+    bool idiomVar(Expr *expr, VarSlot &slot) {
+        DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParens());
+        if (!declref || !isa<VarDecl>(declref->getDecl()) || !declref->getType()->isSpecificBuiltinType(BuiltinType::Int))
+            return false;
+        slot = slotOf(declref->getFoundDecl());
+        return !slot.addressable;
+    }
+
+    //a[i]，a是int数组或int指针变量，下标是循环变量
+    bool idiomElement(Expr *expr, VarSlot index, FusedOperand &base) {
+        ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(expr->IgnoreParens());
+        if (!array || !array->getType()->isSpecificBuiltinType(BuiltinType::Int))
+            return false;
+        FusedOperand idx;
+        if (!fuseOperand(array->getIdx(), idx) || !idx.isVar || !sameSlot(idx.slot, index))
+            return false;
+        ImplicitCastExpr *decay = dyn_cast<ImplicitCastExpr>(array->getBase()->IgnoreParens());
+        DeclRefExpr *declref = decay ? dyn_cast<DeclRefExpr>(decay->getSubExpr()->IgnoreParens()) : NULL;
+        if (!declref || !isa<VarDecl>(declref->getDecl()))
+            return false;
+        base.isVar = true;
+        base.slot = slotOf(declref->getFoundDecl());
+        return !base.slot.addressable;
+    }
+
+    //数组元素b[i]的值，或者循环中不变的int变量和字面值
+    bool idiomOperand(Expr *expr, VarSlot index, IdiomOperand &operand) {
+        expr = expr->IgnoreParens();
+        ImplicitCastExpr *load = dyn_cast<ImplicitCastExpr>(expr);
+        operand.isArray = load && load->getCastKind() == CK_LValueToRValue &&
+                          idiomElement(load->getSubExpr(), index, operand.base);
+        if (operand.isArray)
+            return true;
+        if (!fuseOperand(expr, operand.base))
+            return false;
+        return !operand.base.isVar || (!operand.base.slot.addressable && !sameSlot(operand.base.slot, index));
+    }
+
+    long fusedValue(const FusedOperand &operand) {
+        return operand.isVar ? loadSlot(operand.slot) : operand.constant;
+    }
+
+    //数组操作数从第lo个元素开始的count个单元，越界或者不是数组时为NULL
+    long *idiomData(const IdiomOperand &operand, long lo, long count) {
+        if (!operand.isArray)
+            return NULL;
+        return mHeap.Data(loadSlot(operand.base.slot) + lo, count);
+    }
+
+    //写入的单元与读取的单元要么完全相同，要么不重叠
+    static bool unaliased(const long *dst, const long *src, long count) {
+        return !src || src == dst || src + count <= dst || dst + count <= src;
+    }
+
+    //为没有定义的函数解析本地实现，同一个函数的多个声明只解析一次
+    void bindNative(FunctionDecl *fdecl) {
+        const FunctionDecl *canon = fdecl->getCanonicalDecl();
+        if (mNativeIndex.count(canon))
+            return ;
+        mNativeIndex[canon] = mNatives.size();
+        mNatives.push_back(natives().resolve(fdecl));
+    }
+
+    //注册表不会销毁，打开的共享库一直保留到进程结束
+    static NativeRegistry *newRegistry() {
+        NativeRegistry *registry = new NativeRegistry();
+        registry->add("get", builtinGet);
+        registry->add("print", builtinPrint);
+        registry->add("malloc", builtinMalloc);
+        registry->add("free", builtinFree);
+        registry->add("sort_ints", builtinSortInts);
+        registry->add("hash_ints", builtinHashInts);
+        return registry;
     }
 };
 
@@ -0,0 +1,215 @@
+#ifndef HEAPSTATS_HPP
+#define HEAPSTATS_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+/* 堆的统计：使用--heap-report时Heap在每次分配和释放时通知HeapTracker，记录存活和峰值单元数、
+ * 按大小分级和按malloc调用位置的分配次数，程序结束时列出没有释放的块。
+ * 全局数组、栈内存等由解释器自己分配的块没有调用位置，计入存活和峰值单元数，但不算泄漏。
+ * 不统计时Heap中只多一次空指针判断
+ */
+class HeapTracker {
+public:
+    HeapTracker()
+    : mBlocks(), mSites(), mMallocs(0), mFrees(0), mLiveCells(0), mPeakCells(0), mInternalCells(0) {
+        std::fill(mSizeClasses, mSizeClasses + kNumClasses, 0);
+    }
+
+    //分配了从addr开始的size个单元，site为程序中调用malloc的表达式，解释器自己分配时为NULL
+    void allocated(long addr, long size, const Stmt *site) {
+        Block block = { size, site };
+        mBlocks[addr] = block;
+        mLiveCells += size;
+        if (mLiveCells > mPeakCells)
+            mPeakCells = mLiveCells;
+        if (!site) {
+            mInternalCells += size;
+            return ;
+        }
+        ++mMallocs;
+        ++mSizeClasses[sizeClass(size)];
+        SiteStats &stats = mSites[site];
+        ++stats.mallocs;
+        stats.cells += size;
+        ++stats.liveBlocks;
+        stats.liveCells += size;
+    }
+
+    //释放了从addr开始的块
+    void freed(long addr) {
+        auto it = mBlocks.find(addr);
+        if (it == mBlocks.end())
+            return ;
+        Block block = it->second;
+        mBlocks.erase(it);
+        mLiveCells -= block.size;
+        if (!block.site) {
+            mInternalCells -= block.size;
+            return ;
+        }
+        ++mFrees;
+        SiteStats &stats = mSites[block.site];
+        ++stats.frees;
+        --stats.liveBlocks;
+        stats.liveCells -= block.size;
+    }
+
+    //输出汇总、大小分布，以及存活单元最多(即泄漏最多)的调用位置
+    void report(llvm::raw_ostream &os, const SourceManager &sm) {
+        unsigned long leaked_blocks;
+        long leaked_cells;
+        leaks(leaked_blocks, leaked_cells);
+        char line[160];
+        snprintf(line, sizeof(line), "heap: %lu mallocs, %lu frees, peak %ld live cells, %ld live at exit "
+                 "(%ld owned by the interpreter)\n", mMallocs, mFrees, mPeakCells, mLiveCells, mInternalCells);
+        os << line;
+
+        snprintf(line, sizeof(line), "%-24s %12s\n", "size (cells)", "mallocs");
+        os << line;
+        for (int c = 0; c < kNumClasses; ++c) {
+            if (!mSizeClasses[c])
+                continue;
+            snprintf(line, sizeof(line), "%-24s %12lu\n", classLabel(c).c_str(), mSizeClasses[c]);
+            os << line;
+        }
+
+        std::vector<std::pair<const Stmt *, SiteStats>> sites = sortedSites();
+        snprintf(line, sizeof(line), "%-24s %12s %12s %12s %12s\n", "site", "mallocs", "cells", "live blocks",
+                 "live cells");
+        os << line;
+        for (size_t i = 0; i < sites.size() && i < kReportSites; ++i) {
+            const SiteStats &stats = sites[i].second;
+            snprintf(line, sizeof(line), "%-24s %12lu %12ld %12lu %12ld\n", location(sm, sites[i].first).c_str(),
+                     stats.mallocs, stats.cells, stats.liveBlocks, stats.liveCells);
+            os << line;
+        }
+        snprintf(line, sizeof(line), "leaks: %lu blocks, %ld cells not freed at exit\n", leaked_blocks, leaked_cells);
+        os << line;
+    }
+
+    //以JSON格式输出所有统计，调用位置按存活单元数从多到少排列
+    void writeJson(llvm::raw_ostream &os, const SourceManager &sm) {
+        unsigned long leaked_blocks;
+        long leaked_cells;
+        leaks(leaked_blocks, leaked_cells);
+        os << "{\n"
+           << "  \"mallocs\": " << mMallocs << ",\n"
+           << "  \"frees\": " << mFrees << ",\n"
+           << "  \"live_cells\": " << mLiveCells << ",\n"
+           << "  \"peak_live_cells\": " << mPeakCells << ",\n"
+           << "  \"interpreter_cells\": " << mInternalCells << ",\n"
+           << "  \"leaked_blocks\": " << leaked_blocks << ",\n"
+           << "  \"leaked_cells\": " << leaked_cells << ",\n"
+           << "  \"size_classes\": [";
+        const char *separator = "\n";
+        for (int c = 0; c < kNumClasses; ++c) {
+            if (!mSizeClasses[c])
+                continue;
+            os << separator << "    {\"min\": " << (c ? 1L << c : 0) << ", \"max\": " << (1L << (c + 1)) - 1
+               << ", \"mallocs\": " << mSizeClasses[c] << "}";
+            separator = ",\n";
+        }
+        os << "\n  ],\n"
+           << "  \"sites\": [";
+        separator = "\n";
+        for (const auto &entry : sortedSites()) {
+            const SiteStats &stats = entry.second;
+            PresumedLoc loc = presumed(sm, entry.first);
+            os << separator << "    {\"line\": " << (loc.isValid() ? loc.getLine() : 0)
+               << ", \"column\": " << (loc.isValid() ? loc.getColumn() : 0)
+               << ", \"mallocs\": " << stats.mallocs << ", \"frees\": " << stats.frees
+               << ", \"cells\": " << stats.cells << ", \"live_blocks\": " << stats.liveBlocks
+               << ", \"live_cells\": " << stats.liveCells << "}";
+            separator = ",\n";
+        }
+        os << "\n  ]\n"
+           << "}\n";
+    }
+
+private:
+    //大小按以2为底的对数分级，与Heap的空闲链表相同
+    static const int kNumClasses = 64;
+    //文本报告中列出的调用位置个数
+    static const size_t kReportSites = 20;
+
+    struct Block {
+        long size;
+        const Stmt *site;
+    };
+
+    struct SiteStats {
+        unsigned long mallocs;
+        unsigned long frees;
+        long cells;                 //分配的单元总数
+        unsigned long liveBlocks;   //还没有释放的块
+        long liveCells;
+
+        SiteStats() : mallocs(0), frees(0), cells(0), liveBlocks(0), liveCells(0) {}
+    };
+
+    //0和1个单元都在第0级
+    static int sizeClass(long size) {
+        return size > 1 ? llvm::Log2_64(size) : 0;
+    }
+    static std::string classLabel(int c) {
+        long min = c ? 1L << c : 0;
+        long max = (1L << (c + 1)) - 1;
+        return std::to_string(min) + "-" + std::to_string(max);
+    }
+
+    //程序结束时还没有释放的块就是泄漏
+    void leaks(unsigned long &blocks, long &cells) {
+        blocks = 0;
+        cells = 0;
+        for (const auto &entry : mSites) {
+            blocks += entry.second.liveBlocks;
+            cells += entry.second.liveCells;
+        }
+    }
+
+    std::vector<std::pair<const Stmt *, SiteStats>> sortedSites() {
+        std::vector<std::pair<const Stmt *, SiteStats>> sites(mSites.begin(), mSites.end());
+        std::sort(sites.begin(), sites.end(),
+                  [](const std::pair<const Stmt *, SiteStats> &a, const std::pair<const Stmt *, SiteStats> &b) {
+                      if (a.second.liveCells != b.second.liveCells)
+                          return a.second.liveCells > b.second.liveCells;
+                      return a.second.cells > b.second.cells;
+                  });
+        return sites;
+    }
+
+    static PresumedLoc presumed(const SourceManager &sm, const Stmt *site) {
+        return sm.getPresumedLoc(sm.getExpansionLoc(site->getLocStart()));
+    }
+    //调用位置的行号和列号
+    static std::string location(const SourceManager &sm, const Stmt *site) {
+        PresumedLoc loc = presumed(sm, site);
+        if (loc.isInvalid())
+            return "?";
+        return std::to_string(loc.getLine()) + ":" + std::to_string(loc.getColumn());
+    }
+
+    //存活的块的起始地址到大小和调用位置的映射
+    llvm::DenseMap<long, Block> mBlocks;
+    llvm::DenseMap<const Stmt *, SiteStats> mSites;
+    unsigned long mSizeClasses[kNumClasses];
+    unsigned long mMallocs;
+    unsigned long mFrees;
+    long mLiveCells;
+    long mPeakCells;
+    long mInternalCells;    //解释器自己分配的存活单元数
+};
+
+#endif  // ~HEAPSTATS_HPP
@@ -0,0 +1,195 @@
+#ifndef IO_HPP
+#define IO_HPP
+
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "llvm/Support/raw_ostream.h"
+
+//内建函数get和print的输入输出，每个Environment使用一个，不同的运行方式提供不同的实现
+class ProgramIO {
+public:
+    virtual ~ProgramIO() {}
+
+    //get：读入一个整数，没有输入时返回0
+    virtual int read() = 0;
+    //print：输出一个整数
+    virtual void write(int val) = 0;
+    //程序结束时调用，输出缓冲区中剩余的内容
+    virtual void flush() {}
+};
+
+//命令行方式：提示后从标准输入读入，输出到标准错误
+class ConsoleIO : public ProgramIO {
+public:
+    virtual int read() {
+        llvm::errs() << "Please input an integer: ";
+        int val = 0;
+        std::cin >> val;
+        return val;
+    }
+
+    virtual void write(int val) {
+        llvm::errs() << val << '\n';
+    }
+
+    //ConsoleIO没有状态，所有Environment共用一个
+    static ConsoleIO &instance() {
+        static ConsoleIO io;
+        return io;
+    }
+};
+
+/* 整数的解析和格式化，不经过流和locale。scanInt像std::cin >> val一样跳过空白读入
+ * 一个可带符号的十进制整数，pos前进到整数之后，没有整数时返回0
+ */
+static int scanInt(const char *data, size_t size, size_t &pos) {
+    while (pos < size && isspace((unsigned char)data[pos]))
+        ++pos;
+    bool negative = false;
+    if (pos < size && (data[pos] == '-' || data[pos] == '+')) {
+        negative = data[pos] == '-';
+        ++pos;
+    }
+    long val = 0;
+    while (pos < size && isdigit((unsigned char)data[pos])) {
+        val = val * 10 + (data[pos] - '0');
+        ++pos;
+    }
+    return negative ? -val : val;
+}
+
+//把val和换行符追加到out末尾
+static void appendInt(std::string &out, int val) {
+    char buffer[16];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+    *--p = '\n';
+    unsigned long magnitude = val < 0 ? -(long)val : val;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (val < 0)
+        *--p = '-';
+    out.append(p, end);
+}
+
+//从内存中读入，输出到内存中，没有提示，用于批量执行
+class StringIO : public ProgramIO {
+public:
+    explicit StringIO(const std::string &input) : mInput(input), mPos(0), mOutput() {}
+
+    virtual int read() {
+        return scanInt(mInput.data(), mInput.size(), mPos);
+    }
+
+    virtual void write(int val) {
+        appendInt(mOutput, val);
+    }
+
+    const std::string &output() const {
+        return mOutput;
+    }
+
+private:
+    std::string mInput;
+    size_t mPos;
+    std::string mOutput;
+};
+
+/* 非交互方式：不输出提示，输入整块读入后就地解析，输出先放在大缓冲区中，
+ * 缓冲区满了或者程序结束时才写出，大量读写整数时不再受系统调用和流格式化的限制
+ */
+class BufferedIO : public ProgramIO {
+public:
+    explicit BufferedIO(int in_fd = STDIN_FILENO, int out_fd = STDERR_FILENO)
+    : mInFd(in_fd), mOutFd(out_fd), mInput(kBufferSize), mPos(0), mEnd(0), mEof(false), mOutput() {
+        mOutput.reserve(kBufferSize);
+    }
+    virtual ~BufferedIO() {
+        flush();
+    }
+
+    virtual int read() {
+        int c;
+        while ((c = peek()) != EOF && isspace(c))
+            ++mPos;
+
+        bool negative = false;
+        if (c == '-' || c == '+') {
+            negative = c == '-';
+            ++mPos;
+        }
+        long val = 0;
+        for (;;) {
+            //缓冲区中的数字直接解析，只有整数跨过缓冲区末尾时才需要重新读入
+            while (mPos < mEnd && isdigit((unsigned char)mInput[mPos]))
+                val = val * 10 + (mInput[mPos++] - '0');
+            if (mPos < mEnd || !fill())
+                break;
+        }
+        return negative ? -val : val;
+    }
+
+    virtual void write(int val) {
+        if (mOutput.size() + kMaxIntText > kBufferSize)
+            flush();
+        appendInt(mOutput, val);
+    }
+
+    virtual void flush() {
+        const char *data = mOutput.data();
+        size_t size = mOutput.size();
+        while (size > 0) {
+            ssize_t n = ::write(mOutFd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            data += n;
+            size -= n;
+        }
+        mOutput.clear();
+    }
+
+private:
+    static const size_t kBufferSize = 1 << 16;
+    //一个int加上换行符最多占用的字符数
+    static const size_t kMaxIntText = 12;
+
+    int peek() {
+        if (mPos == mEnd && !fill())
+            return EOF;
+        return (unsigned char)mInput[mPos];
+    }
+
+    bool fill() {
+        if (mEof)
+            return false;
+        ssize_t n;
+        do {
+            n = ::read(mInFd, mInput.data(), mInput.size());
+        } while (n < 0 && errno == EINTR);
+        mPos = 0;
+        mEnd = n > 0 ? n : 0;
+        mEof = mEnd == 0;
+        return !mEof;
+    }
+
+    int mInFd;
+    int mOutFd;
+    std::vector<char> mInput;
+    size_t mPos;
+    size_t mEnd;
+    bool mEof;
+    std::string mOutput;
+};
+
+#endif  // ~IO_HPP
@@ -0,0 +1,289 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Mangle.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/Basic/Diagnostic.h"
+#include "clang/CodeGen/ModuleBuilder.h"
+#include "clang/Frontend/CodeGenOptions.h"
+#include "clang/Lex/HeaderSearchOptions.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+#include "environment.hpp"
+
+using namespace clang;
+
+/* 热点函数的本地代码编译。只编译纯整数运算的函数：参数为int，返回int或void，
+ * 不使用指针、数组和全局变量，只调用同样满足条件的函数、内建函数print/get和共享库中的C函数。
+ * 解释器的指针是堆单元的编号而不是真实地址，所以涉及指针的函数(包括malloc/free)
+ * 仍然解释执行
+ */
+class JitEligibility : public RecursiveASTVisitor<JitEligibility> {
+public:
+    JitEligibility() : mOk(true), mCallees() {}
+
+    //检查函数签名和函数体，函数体中调用的函数记入getCallees()
+    bool check(FunctionDecl *fdecl) {
+        if (!isJitInt(fdecl->getReturnType()) && !fdecl->getReturnType()->isVoidType())
+            return false;
+        if (fdecl->getNumParams() > NativeCompiler::kMaxParams)
+            return false;
+        for (ParmVarDecl *param : fdecl->parameters())
+            if (!isJitInt(param->getType()))
+                return false;
+        TraverseStmt(fdecl->getBody());
+        return mOk;
+    }
+
+    const std::vector<FunctionDecl *> &getCallees() const {
+        return mCallees;
+    }
+
+    bool VisitExpr(Expr *expr) {
+        QualType type = expr->getType();
+        if (type->isIntegerType() || type->isVoidType() || type->isFunctionType() ||
+                type->isFunctionPointerType())
+            return true;
+        return fail();
+    }
+
+    //CodeGen按目标平台计算sizeof，与解释器的sizeOfType不同；化简后的语法树里已经是字面值
+    bool VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *) {
+        return fail();
+    }
+
+    bool VisitDeclRefExpr(DeclRefExpr *ref) {
+        if (VarDecl *var = dyn_cast<VarDecl>(ref->getDecl())) {
+            if (!var->hasLocalStorage())    //全局变量在解释器中，本地代码看不到
+                return fail();
+        }
+        else if (FunctionDecl *callee = dyn_cast<FunctionDecl>(ref->getDecl()))
+            mCallees.push_back(callee);
+        return true;
+    }
+
+    bool VisitVarDecl(VarDecl *var) {
+        if (!var->getType()->isIntegerType())
+            return fail();
+        return true;
+    }
+
+private:
+    static bool isJitInt(QualType type) {
+        return type->isSpecificBuiltinType(BuiltinType::Int);
+    }
+
+    bool fail() {
+        mOk = false;
+        return false;   //中止遍历
+    }
+
+    bool mOk;
+    std::vector<FunctionDecl *> mCallees;
+};
+
+//本地代码调用内建函数时转回解释器，使用当前线程正在执行的Environment
+static void jitPrint(int val) {
+    Environment::current()->output(val);
+}
+static int jitGet() {
+    return Environment::current()->input();
+}
+
+class JitCompiler : public NativeCompiler {
+public:
+    typedef llvm::orc::RTDyldObjectLinkingLayer ObjectLayer;
+    typedef llvm::orc::IRCompileLayer<ObjectLayer, llvm::orc::SimpleCompiler> CompileLayer;
+
+    JitCompiler(ASTContext &context, DiagnosticsEngine &diags,
+                const HeaderSearchOptions &header_search_opts,
+                const PreprocessorOptions &preprocessor_opts)
+    : mASTContext(context), mDiags(diags), mHeaderSearchOpts(header_search_opts),
+      mPreprocessorOpts(preprocessor_opts), mCodeGenOpts(), mLLVMContext(),
+      mTarget(initTarget()), mObjectLayer([]() { return std::make_shared<llvm::SectionMemoryManager>(); }),
+      mCompileLayer(mObjectLayer, llvm::orc::SimpleCompiler(*mTarget)),
+      mMangler(context.createMangleContext()), mCompiled(), mBridges() {
+        //不优化时clang会给函数加上optnone，JIT之后的优化就不起作用了
+        mCodeGenOpts.OptimizationLevel = 2;
+        llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+    }
+
+    //编译fdecl及其调用的尚未编译的函数，返回fdecl的本地代码地址，失败时返回nullptr
+    virtual void *compile(FunctionDecl *fdecl) {
+        std::lock_guard<std::mutex> lock(astContextMutex());
+        FunctionDecl *definition = fdecl->getDefinition();
+        if (!definition)
+            return nullptr;
+        auto done = mCompiled.find(mangle(definition));
+        if (done != mCompiled.end())
+            return done->second;
+
+        std::vector<FunctionDecl *> closure;
+        llvm::DenseSet<const FunctionDecl *> seen;
+        if (!collect(definition, closure, seen))
+            return nullptr;
+
+        std::unique_ptr<CodeGenerator> codegen(CreateLLVMCodeGen(mDiags, "cinterpreter-jit",
+                mHeaderSearchOpts, mPreprocessorOpts, mCodeGenOpts, mLLVMContext));
+        codegen->Initialize(mASTContext);
+        for (FunctionDecl *fn : closure)
+            codegen->HandleTopLevelDecl(DeclGroupRef(fn));
+        codegen->HandleTranslationUnit(mASTContext);
+        std::unique_ptr<llvm::Module> module(codegen->ReleaseModule());
+        if (!module || llvm::verifyModule(*module, &llvm::errs()))
+            return nullptr;
+
+        module->setDataLayout(mTarget->createDataLayout());
+        optimize(*module);
+        addModule(std::move(module));
+
+        //新模块中的函数都已经可以调用了
+        for (FunctionDecl *fn : closure) {
+            std::string name = mangle(fn);
+            mCompiled[name] = nullptr;
+            llvm::JITSymbol symbol = mCompileLayer.findSymbol(name, false);
+            if (!symbol)
+                continue;
+            llvm::Expected<llvm::JITTargetAddress> addr = symbol.getAddress();
+            if (!addr) {
+                llvm::consumeError(addr.takeError());
+                continue;
+            }
+            mCompiled[name] = reinterpret_cast<void *>(static_cast<uintptr_t>(*addr));
+        }
+        return mCompiled[mangle(definition)];
+    }
+
+private:
+    static llvm::TargetMachine *initTarget() {
+        static std::once_flag once;
+        std::call_once(once, []() {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+        return llvm::EngineBuilder().selectTarget();
+    }
+
+    std::string mangle(const FunctionDecl *fdecl) {
+        if (!mMangler->shouldMangleDeclName(fdecl))
+            return fdecl->getName().str();
+        std::string name;
+        llvm::raw_string_ostream os(name);
+        mMangler->mangleName(fdecl, os);
+        return os.str();
+    }
+
+    //收集需要一起编译的函数，已经编译过的函数只需要声明，由符号解析找到
+    bool collect(FunctionDecl *fdecl, std::vector<FunctionDecl *> &closure,
+                 llvm::DenseSet<const FunctionDecl *> &seen) {
+        if (!seen.insert(fdecl).second)
+            return true;
+        auto done = mCompiled.find(mangle(fdecl));
+        if (done != mCompiled.end())
+            return done->second != nullptr;
+
+        JitEligibility checker;
+        if (!checker.check(fdecl))
+            return false;
+        closure.push_back(fdecl);
+
+        for (FunctionDecl *callee : checker.getCallees()) {
+            if (FunctionDecl *definition = callee->getDefinition()) {
+                if (!collect(definition, closure, seen))
+                    return false;
+            }
+            else if (callee->getName() == "print")
+                mBridges[mangle(callee)] = reinterpret_cast<void *>(&jitPrint);
+            else if (callee->getName() == "get")
+                mBridges[mangle(callee)] = reinterpret_cast<void *>(&jitGet);
+            else {
+                //共享库中的C函数参数和返回值都是整数，本地代码直接调用
+                NativeBinding binding = Environment::natives().resolve(callee);
+                if (!binding.symbol)
+                    return false;
+                mBridges[mangle(callee)] = binding.symbol;
+            }
+        }
+        return true;
+    }
+
+    void optimize(llvm::Module &module) {
+        llvm::PassManagerBuilder builder;
+        builder.OptLevel = 2;
+        builder.Inliner = llvm::createFunctionInliningPass(2, 0, false);
+
+        llvm::legacy::FunctionPassManager function_passes(&module);
+        llvm::legacy::PassManager module_passes;
+        builder.populateFunctionPassManager(function_passes);
+        builder.populateModulePassManager(module_passes);
+
+        function_passes.doInitialization();
+        for (llvm::Function &fn : module)
+            function_passes.run(fn);
+        function_passes.doFinalization();
+        module_passes.run(module);
+    }
+
+    void addModule(std::unique_ptr<llvm::Module> module) {
+        //先找JIT编译过的函数，再找内建函数的桥接，最后在进程中查找
+        auto resolver = llvm::orc::createLambdaResolver(
+            [this](const std::string &name) {
+                if (auto symbol = mCompileLayer.findSymbol(name, false))
+                    return symbol;
+                auto bridge = mBridges.find(name);
+                if (bridge != mBridges.end())
+                    return llvm::JITSymbol(reinterpret_cast<uintptr_t>(bridge->second),
+                                           llvm::JITSymbolFlags::Exported);
+                return llvm::JITSymbol(nullptr);
+            },
+            [](const std::string &name) {
+                if (auto addr = llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name))
+                    return llvm::JITSymbol(addr, llvm::JITSymbolFlags::Exported);
+                return llvm::JITSymbol(nullptr);
+            });
+        llvm::cantFail(mCompileLayer.addModule(std::move(module), std::move(resolver)));
+    }
+
+    ASTContext &mASTContext;
+    DiagnosticsEngine &mDiags;
+    const HeaderSearchOptions &mHeaderSearchOpts;
+    const PreprocessorOptions &mPreprocessorOpts;
+    CodeGenOptions mCodeGenOpts;
+    llvm::LLVMContext mLLVMContext;
+    std::unique_ptr<llvm::TargetMachine> mTarget;
+    ObjectLayer mObjectLayer;
+    CompileLayer mCompileLayer;
+    std::unique_ptr<MangleContext> mMangler;
+    //已经编译的函数(按符号名)到本地代码地址的映射，编译失败的为nullptr
+    std::map<std::string, void *> mCompiled;
+    //内建函数的符号名到桥接函数的映射
+    std::map<std::string, void *> mBridges;
+};
+
+#endif  // ~JIT_HPP
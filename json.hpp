@@ -0,0 +1,33 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <cstdio>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+//把text转为JSON字符串(带引号)，各种结果和统计以JSON格式输出时使用
+static std::string jsonString(llvm::StringRef text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if ((unsigned char)c < 0x20) {
+                char buffer[8];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out += buffer;
+            }
+            else
+                out += c;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+#endif  // ~JSON_HPP
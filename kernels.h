@@ -0,0 +1,13 @@
+/*
+ * Array kernels implemented natively by the interpreter. Include
+ * this file next to sysfun.h to sort or hash an int array at native
+ * speed instead of looping in interpreted code.
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+extern void sort_ints(int *a, int n);
+extern int hash_ints(int *a, int n);
+
+#endif // ~KERNELS_H
@@ -0,0 +1,185 @@
+#ifndef NATIVES_HPP
+#define NATIVES_HPP
+
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Type.h"
+#include "llvm/ADT/StringMap.h"
+
+using namespace clang;
+
+class Environment;
+
+//解释器内部用C++实现的本地函数，实参和返回值都是解释器中的值，指针是堆单元的编号
+typedef long (*BuiltinFunction)(Environment &env, const long *args);
+
+//参数或返回值的类型，只支持整数和指针，bits为0表示void
+struct NativeType {
+    unsigned bits;
+    bool isSigned;
+    bool isPointer;
+
+    //把解释器中的值按类型截断并扩展为long
+    long convert(long val) const {
+        if (bits == 0)
+            return 0;
+        if (isPointer || bits >= 64)
+            return val;
+        unsigned long mask = (1UL << bits) - 1;
+        unsigned long raw = (unsigned long)val & mask;
+        if (isSigned && (raw >> (bits - 1)))
+            raw |= ~mask;
+        return (long)raw;
+    }
+};
+
+/* 函数声明绑定的本地实现，每个没有定义的函数声明在执行前解析一次，
+ * 调用时按声明的类型转换实参和返回值
+ */
+struct NativeBinding {
+    static const unsigned kMaxParams = 6;
+
+    std::string name;
+    BuiltinFunction builtin;    //内部实现
+    void *symbol;               //dlsym取得的C函数，builtin为NULL时使用
+    std::string error;          //两者都为NULL时不能调用的原因
+    unsigned numParams;
+    NativeType params[kMaxParams];
+    NativeType result;
+
+    NativeBinding() : name(), builtin(NULL), symbol(NULL), error(), numParams(0), params(), result() {}
+
+    bool isBound() const {
+        return builtin || symbol;
+    }
+
+    long invoke(Environment &env, const long *args) const {
+        long argv[kMaxParams] = { 0 };
+        for (unsigned i = 0; i < numParams; ++i)
+            argv[i] = params[i].convert(args[i]);
+        if (builtin)
+            return result.convert(builtin(env, argv));
+        //参数都是整数，按x86-64和AArch64的调用约定放在整数寄存器中，多传的实参被忽略
+        typedef long (*CFunction)(long, long, long, long, long, long);
+        long val = reinterpret_cast<CFunction>(symbol)(argv[0], argv[1], argv[2], argv[3], argv[4], argv[5]);
+        return result.convert(val);
+    }
+};
+
+/* 本地函数注册表：内部实现按名字登记，--native-lib指定的共享库在执行前打开，
+ * 找不到内部实现的函数声明到这些库中查找同名的符号，再到解释器进程自身中查找，
+ * 但进程中只能找到kProcessSymbols中没有副作用的libc函数，程序不能调用fork、kill这类函数。
+ * 注册和加载只在启动时进行，之后多个线程只读地解析。打开的库不再关闭
+ */
+class NativeRegistry {
+public:
+    NativeRegistry() : mBuiltins(), mLibraries(), mProcessSymbols(true) {}
+
+    void add(llvm::StringRef name, BuiltinFunction fn) {
+        mBuiltins[name] = fn;
+    }
+
+    //打开共享库，失败时返回false并设置error
+    bool loadLibrary(const std::string &path, std::string &error) {
+        void *handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+            const char *reason = dlerror();
+            error = reason ? std::string(reason) : "cannot open " + path;
+            return false;
+        }
+        mLibraries.push_back(handle);
+        return true;
+    }
+
+    //是否到进程自身中查找允许的函数，服务模式默认不查找
+    void setProcessSymbols(bool enabled) {
+        mProcessSymbols = enabled;
+    }
+
+    //为没有定义的函数声明解析本地实现，找不到或者签名不支持时binding.error说明原因
+    NativeBinding resolve(const FunctionDecl *fdecl) const {
+        NativeBinding binding;
+        binding.name = fdecl->getNameAsString();
+        auto it = mBuiltins.find(binding.name);
+        bool builtin = it != mBuiltins.end();
+        if (!describe(fdecl, builtin, binding))
+            return binding;
+        if (builtin) {
+            binding.builtin = it->second;
+            return binding;
+        }
+        for (void *handle : mLibraries) {
+            if ((binding.symbol = dlsym(handle, binding.name.c_str())))
+                return binding;
+        }
+        if (mProcessSymbols && processSymbol(binding.name))
+            binding.symbol = dlsym(RTLD_DEFAULT, binding.name.c_str());
+        if (!binding.symbol)
+            binding.error = "undefined function " + binding.name;
+        return binding;
+    }
+
+private:
+    /* 进程中可以绑定的函数：只有整数参数和返回值、没有副作用的libc函数。
+     * libm的函数参数是double，本来就不能绑定
+     */
+    static bool processSymbol(const std::string &name) {
+        static const char *const kProcessSymbols[] = {
+            "abs", "labs", "llabs", "ffs", "ffsl", "toupper", "tolower",
+            "isalnum", "isalpha", "isblank", "iscntrl", "isdigit", "isgraph",
+            "islower", "isprint", "ispunct", "isspace", "isupper", "isxdigit",
+        };
+        for (const char *symbol : kProcessSymbols)
+            if (name == symbol)
+                return true;
+        return false;
+    }
+
+    //记录参数和返回值的类型，C函数不能接收解释器的指针
+    static bool describe(const FunctionDecl *fdecl, bool builtin, NativeBinding &binding) {
+        if (fdecl->isVariadic() || fdecl->getNumParams() > NativeBinding::kMaxParams) {
+            binding.error = "unsupported signature of native function " + binding.name;
+            return false;
+        }
+        binding.numParams = fdecl->getNumParams();
+        for (unsigned i = 0; i < binding.numParams; ++i) {
+            if (!typeOf(fdecl->getASTContext(), fdecl->getParamDecl(i)->getType(), builtin, binding.params[i])) {
+                binding.error = "unsupported parameter type of native function " + binding.name;
+                return false;
+            }
+        }
+        QualType ret = fdecl->getReturnType();
+        if (ret->isVoidType())
+            binding.result = NativeType();
+        else if (!typeOf(fdecl->getASTContext(), ret, builtin, binding.result)) {
+            binding.error = "unsupported return type of native function " + binding.name;
+            return false;
+        }
+        return true;
+    }
+
+    static bool typeOf(const ASTContext &context, QualType type, bool builtin, NativeType &native) {
+        type = type.getCanonicalType();
+        native.isPointer = type->isPointerType();
+        if (native.isPointer) {
+            native.bits = 64;
+            native.isSigned = false;
+            return builtin;
+        }
+        if (!type->isIntegerType())
+            return false;
+        native.bits = context.getIntWidth(type);
+        native.isSigned = type->isSignedIntegerType();
+        return true;
+    }
+
+    llvm::StringMap<BuiltinFunction> mBuiltins;
+    std::vector<void *> mLibraries;
+    bool mProcessSymbols;
+};
+
+#endif  // ~NATIVES_HPP
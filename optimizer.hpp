@@ -0,0 +1,164 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+
+#include "values.hpp"
+
+using namespace clang;
+
+/* 执行前对语法树的化简，直接改写语法树，两种执行方式和JIT都执行化简后的语法树：
+ * 1. 常量子表达式折叠为整数字面值，如2 * 8 + 1、sizeof(int) * 4，sizeof按解释器的大小折叠
+ * 2. 条件为常量的if语句只保留执行的分支，条件为假的while、for循环只保留初始化语句
+ * 3. 去掉括号表达式和只改变限定符的类型转换
+ * 改写后语法树的类型保持不变，所以不影响CodeGen
+ */
+class ASTOptimizer {
+public:
+    explicit ASTOptimizer(ASTContext &context)
+    : mContext(context), mFolded(0), mRemoved(0) {}
+
+    //化简所有函数体和全局变量的初始值
+    void run(TranslationUnitDecl *unit) {
+        for (Decl *decl : unit->decls())
+            optimize(decl);
+    }
+
+    //化简一个顶层声明，REPL每解析一个声明化简一次
+    void optimize(Decl *decl) {
+        if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(decl)) {
+            if (fdecl->doesThisDeclarationHaveABody())
+                fdecl->setBody(rewrite(fdecl->getBody()));
+        }
+        else if (VarDecl *vardecl = dyn_cast<VarDecl>(decl)) {
+            if (vardecl->hasInit())
+                vardecl->setInit(cast<Expr>(rewrite(vardecl->getInit())));
+        }
+    }
+
+    //折叠的表达式个数和删除的语句个数
+    unsigned getFolded() const {
+        return mFolded;
+    }
+    unsigned getRemoved() const {
+        return mRemoved;
+    }
+
+private:
+    //返回stmt化简后的结果，子节点就地替换
+    Stmt *rewrite(Stmt *stmt) {
+        if (!stmt)
+            return stmt;
+        //含sizeof的表达式先把sizeof换成字面值再折叠，clang按目标平台计算的sizeof与解释器不同
+        bool has_sizeof = containsSizeOf(stmt);
+        if (Expr *expr = dyn_cast<Expr>(stmt)) {
+            if (!has_sizeof) {
+                if (Expr *literal = fold(expr))
+                    return literal;
+            }
+        }
+
+        for (Stmt *&child : stmt->children())
+            child = rewrite(child);
+
+        if (UnaryExprOrTypeTraitExpr *uett = dyn_cast<UnaryExprOrTypeTraitExpr>(stmt))
+            return foldSizeOf(uett);
+        if (has_sizeof && isa<Expr>(stmt)) {
+            if (Expr *literal = fold(cast<Expr>(stmt)))
+                return literal;
+        }
+        if (ParenExpr *paren = dyn_cast<ParenExpr>(stmt))
+            return paren->getSubExpr();
+        if (CastExpr *castexpr = dyn_cast<CastExpr>(stmt)) {
+            Expr *sub_expr = castexpr->getSubExpr();
+            if (castexpr->getCastKind() == CK_NoOp && castexpr->getValueKind() == sub_expr->getValueKind() &&
+                    mContext.hasSameUnqualifiedType(castexpr->getType(), sub_expr->getType()))
+                return sub_expr;
+        }
+        if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt))
+            return rewriteIf(ifstmt);
+        if (WhileStmt *whilestmt = dyn_cast<WhileStmt>(stmt)) {
+            if (!whilestmt->getConditionVariable() && isConstant(whilestmt->getCond(), false))
+                return removed(whilestmt, NULL);
+        }
+        if (ForStmt *forstmt = dyn_cast<ForStmt>(stmt)) {
+            if (forstmt->getCond() && !forstmt->getConditionVariable() &&
+                    isConstant(forstmt->getCond(), false))
+                return removed(forstmt, forstmt->getInit());
+        }
+        return stmt;
+    }
+
+    /* 把值为常量的整数表达式换成整数字面值，不能折叠时返回NULL。
+     * 比int窄的类型(包括bool)不折叠，因为两种执行方式都按有符号数读取字面值
+     */
+    Expr *fold(Expr *expr) {
+        if (isa<IntegerLiteral>(expr) || !expr->isRValue() || expr->isValueDependent())
+            return NULL;
+        QualType type = expr->getType();
+        if (!type->isIntegerType() || mContext.getIntWidth(type) < mContext.getIntWidth(mContext.IntTy))
+            return NULL;
+        llvm::APSInt value;
+        if (!expr->EvaluateAsInt(value, mContext))
+            return NULL;
+        ++mFolded;
+        return IntegerLiteral::Create(mContext, value.extOrTrunc(mContext.getIntWidth(type)), type,
+                                      expr->getLocStart());
+    }
+
+    //stmt中是否有还没换成字面值的sizeof
+    static bool containsSizeOf(Stmt *stmt) {
+        if (!stmt)
+            return false;
+        if (isa<UnaryExprOrTypeTraitExpr>(stmt))
+            return true;
+        for (Stmt *child : stmt->children()) {
+            if (containsSizeOf(child))
+                return true;
+        }
+        return false;
+    }
+
+    //sizeof换成sizeOfType给出的字面值，与遍历执行和字节码的结果相同；alignof等不折叠
+    Expr *foldSizeOf(UnaryExprOrTypeTraitExpr *uett) {
+        if (uett->getKind() != UETT_SizeOf || uett->isValueDependent())
+            return uett;
+        ++mFolded;
+        llvm::APInt value(mContext.getIntWidth(uett->getType()), sizeOfType(uett->getTypeOfArgument()));
+        return IntegerLiteral::Create(mContext, value, uett->getType(), uett->getLocStart());
+    }
+
+    //条件是否为没有副作用、值为expected的常量
+    bool isConstant(Expr *cond, bool expected) {
+        bool value;
+        return !cond->HasSideEffects(mContext) && cond->EvaluateAsBooleanCondition(value, mContext) &&
+               value == expected;
+    }
+
+    Stmt *rewriteIf(IfStmt *ifstmt) {
+        if (ifstmt->getConditionVariable() || ifstmt->getInit())
+            return ifstmt;
+        if (isConstant(ifstmt->getCond(), true))
+            return removed(ifstmt, ifstmt->getThen());
+        if (isConstant(ifstmt->getCond(), false))
+            return removed(ifstmt, ifstmt->getElse());
+        return ifstmt;
+    }
+
+    //用replacement代替stmt，没有替代的语句时换成空语句
+    Stmt *removed(Stmt *stmt, Stmt *replacement) {
+        ++mRemoved;
+        if (replacement)
+            return replacement;
+        return new (mContext) NullStmt(stmt->getLocStart());
+    }
+
+    ASTContext &mContext;
+    unsigned mFolded;
+    unsigned mRemoved;
+};
+
+#endif  // ~OPTIMIZER_HPP
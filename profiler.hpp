@@ -0,0 +1,183 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+/* 遍历语法树时的性能分析：记录每个函数的调用次数、包含和不包含被调函数的时间，
+ * 以及每一行语句的执行次数。时间按调用树累计，最后输出为火焰图工具使用的折叠栈格式：
+ * 每行是“main;foo;bar 微秒数”，表示在这条调用链的最内层函数自身花费的时间。
+ * 不使用--profile时解释器不创建Profiler，遍历时只多一次空指针判断
+ */
+class Profiler {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit Profiler(const SourceManager &sm)
+    : mSM(sm), mNodes(), mFunctions(), mHits(), mFrames(), mStart(Clock::now()), mLast(mStart), mTotal(0) {
+        mNodes.push_back(Node(NULL, 0));    //0号节点是调用树的根，不对应函数
+    }
+
+    //进入一个用户函数
+    void enter(FunctionDecl *function) {
+        Clock::time_point now = charge();
+        unsigned parent = mFrames.empty() ? 0 : mFrames.back().node;
+        unsigned node = mNodes[parent].children.lookup(function);
+        if (node == 0) {
+            node = mNodes.size();
+            mNodes[parent].children[function] = node;
+            mNodes.push_back(Node(function, parent));
+        }
+        Frame frame = { node, function, now };
+        mFrames.push_back(frame);
+
+        FunctionStats &stats = mFunctions[function];
+        ++stats.calls;
+        ++stats.active;
+    }
+
+    //离开当前函数，递归调用只在最外层计入包含时间
+    void leave() {
+        Clock::time_point now = charge();
+        Frame frame = mFrames.back();
+        mFrames.pop_back();
+        FunctionStats &stats = mFunctions[frame.function];
+        if (--stats.active == 0)
+            stats.inclusive += nanos(now - frame.start);
+    }
+
+    //执行一条语句
+    void hit(Stmt *stmt) {
+        ++mHits[stmt];
+    }
+
+    //程序结束，结束所有未返回的函数
+    void finish() {
+        while (!mFrames.empty())
+            leave();
+        mTotal = nanos(mLast - mStart);
+    }
+
+    //输出折叠栈，值为微秒数
+    void writeFolded(llvm::raw_ostream &os) {
+        std::vector<std::string> names(mNodes.size());
+        for (unsigned i = 1; i < mNodes.size(); ++i) {
+            const Node &node = mNodes[i];
+            //子节点总是在父节点之后创建，父节点的名字已经算好
+            std::string name = node.function->getNameAsString();
+            names[i] = node.parent ? names[node.parent] + ";" + name : name;
+            unsigned long micros = node.self / 1000;
+            if (micros)
+                os << names[i] << ' ' << micros << '\n';
+        }
+    }
+
+    //输出最耗时的top个函数和执行次数最多的top行
+    void report(llvm::raw_ostream &os, unsigned top) {
+        std::vector<std::pair<FunctionDecl *, FunctionStats>> functions(mFunctions.begin(), mFunctions.end());
+        std::sort(functions.begin(), functions.end(),
+                  [](const std::pair<FunctionDecl *, FunctionStats> &a,
+                     const std::pair<FunctionDecl *, FunctionStats> &b) {
+                      return a.second.exclusive > b.second.exclusive;
+                  });
+        char line[160];
+        snprintf(line, sizeof(line), "profile: %.3f ms in %zu functions\n", mTotal / 1e6, functions.size());
+        os << line;
+        snprintf(line, sizeof(line), "%-24s %12s %12s %12s %7s\n", "function", "calls", "incl ms", "excl ms", "excl%");
+        os << line;
+        for (size_t i = 0; i < functions.size() && i < top; ++i) {
+            const FunctionStats &stats = functions[i].second;
+            snprintf(line, sizeof(line), "%-24s %12lu %12.3f %12.3f %6.1f%%\n",
+                     functions[i].first->getNameAsString().c_str(), stats.calls, stats.inclusive / 1e6,
+                     stats.exclusive / 1e6, mTotal ? stats.exclusive * 100.0 / mTotal : 0.0);
+            os << line;
+        }
+
+        //同一行上的语句合并计数，语句块只是容器，不计入
+        std::map<unsigned, unsigned long> lines;
+        for (const auto &entry : mHits) {
+            if (isa<CompoundStmt>(entry.first))
+                continue;
+            SourceLocation loc = mSM.getExpansionLoc(entry.first->getLocStart());
+            if (loc.isValid() && mSM.isInMainFile(loc))
+                lines[mSM.getExpansionLineNumber(loc)] += entry.second;
+        }
+        std::vector<std::pair<unsigned, unsigned long>> hot(lines.begin(), lines.end());
+        std::stable_sort(hot.begin(), hot.end(),
+                         [](const std::pair<unsigned, unsigned long> &a, const std::pair<unsigned, unsigned long> &b) {
+                             return a.second > b.second;
+                         });
+        snprintf(line, sizeof(line), "%-24s %12s\n", "line", "hits");
+        os << line;
+        for (size_t i = 0; i < hot.size() && i < top; ++i) {
+            snprintf(line, sizeof(line), "%-24u %12lu\n", hot[i].first, hot[i].second);
+            os << line;
+        }
+    }
+
+private:
+    //调用树的节点，同一条调用链上的同一个函数只有一个节点
+    struct Node {
+        FunctionDecl *function;
+        unsigned parent;
+        unsigned long self;     //自身花费的纳秒数
+        llvm::SmallDenseMap<FunctionDecl *, unsigned, 4> children;
+
+        Node(FunctionDecl *function, unsigned parent) : function(function), parent(parent), self(0), children() {}
+    };
+
+    struct FunctionStats {
+        unsigned long calls;
+        unsigned long inclusive;    //纳秒
+        unsigned long exclusive;    //纳秒
+        unsigned active;            //在调用栈上的层数
+
+        FunctionStats() : calls(0), inclusive(0), exclusive(0), active(0) {}
+    };
+
+    struct Frame {
+        unsigned node;
+        FunctionDecl *function;
+        Clock::time_point start;
+    };
+
+    static unsigned long nanos(Clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    //把上次记录以来的时间计入当前函数自身，返回当前时间
+    Clock::time_point charge() {
+        Clock::time_point now = Clock::now();
+        if (!mFrames.empty()) {
+            unsigned long elapsed = nanos(now - mLast);
+            mNodes[mFrames.back().node].self += elapsed;
+            mFunctions[mFrames.back().function].exclusive += elapsed;
+        }
+        mLast = now;
+        return now;
+    }
+
+    const SourceManager &mSM;
+    std::vector<Node> mNodes;
+    llvm::DenseMap<FunctionDecl *, FunctionStats> mFunctions;
+    llvm::DenseMap<Stmt *, unsigned long> mHits;
+    std::vector<Frame> mFrames;
+    Clock::time_point mStart;
+    Clock::time_point mLast;
+    unsigned long mTotal;   //纳秒
+};
+
+#endif  // ~PROFILER_HPP
@@ -0,0 +1,80 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+/* 服务模式下解释器与客户端之间的协议。连接上传送的都是帧：
+ *   [标记，1字节][负载长度，4字节，本机字节序][负载]
+ * 客户端先发送若干个A帧(命令行选项)，再发送S帧(源程序)或P帧(源程序的路径)，最后发送G帧开始执行。
+ * 执行过程中服务端用O帧发送输出，需要输入时发送R帧，客户端回复I帧，I帧为空表示输入结束，
+ * 执行结束时服务端发送X帧，负载为十进制的退出状态
+ */
+enum FrameTag {
+    FRAME_ARG = 'A',        //命令行选项
+    FRAME_SOURCE = 'S',     //源程序
+    FRAME_PATH = 'P',       //源程序的路径，由服务端读取
+    FRAME_GO = 'G',         //开始执行
+    FRAME_OUTPUT = 'O',     //程序的输出(原来写到标准错误的内容)
+    FRAME_READ = 'R',       //请求输入
+    FRAME_INPUT = 'I',      //输入
+    FRAME_EXIT = 'X',       //退出状态
+};
+
+//默认的套接字路径
+static const char *const kDefaultSocket = "/tmp/cinterpreter.sock";
+//一帧的最大长度，防止错误的长度导致分配过多内存
+static const uint32_t kMaxFrame = 64u << 20;
+
+static bool writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::read(fd, data, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool writeFrame(int fd, char tag, const std::string &payload) {
+    uint32_t size = payload.size();
+    char header[5];
+    header[0] = tag;
+    memcpy(header + 1, &size, sizeof(size));
+    return writeAll(fd, header, sizeof(header)) && writeAll(fd, payload.data(), payload.size());
+}
+
+static bool readFrame(int fd, char &tag, std::string &payload) {
+    char header[5];
+    if (!readAll(fd, header, sizeof(header)))
+        return false;
+    uint32_t size;
+    memcpy(&size, header + 1, sizeof(size));
+    if (size > kMaxFrame)
+        return false;
+    tag = header[0];
+    payload.resize(size);
+    return size == 0 || readAll(fd, &payload[0], size);
+}
+
+#endif  // ~PROTOCOL_HPP
@@ -0,0 +1,351 @@
+#ifndef REPL_HPP
+#define REPL_HPP
+
+#include <cctype>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Lex/Preprocessor.h"
+#include "clang/Parse/Parser.h"
+#include "clang/Sema/Sema.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "values.hpp"
+
+using namespace clang;
+
+//REPL会话的主文件，与sysfun.h中的声明相同
+static const char *const kReplPrelude =
+    "extern int get();\n"
+    "extern void print(int);\n"
+    "extern void *malloc(int);\n"
+    "extern void free(void *);\n";
+
+//执行REPL输入的接口，实现见cinterpreter.cpp，Repl只负责读入和解析
+class ReplBackend {
+public:
+    virtual ~ReplBackend() {}
+
+    //登记一个新的顶层声明，execute为false表示输入有错误，不求值全局变量的初始值
+    virtual void declare(Decl *decl, bool execute) = 0;
+    //执行包装了输入的函数，val为函数的返回值，程序被终止时返回false
+    virtual bool run(FunctionDecl *fdecl, long &val) = 0;
+};
+
+/* 增量解析：一个CompilerInstance在整个会话中一直存在，预处理器打开增量模式，
+ * 主文件结束时不结束翻译单元。每次输入作为一个新的内存文件进入预处理器，由同一个Parser和Sema
+ * 接着解析，之前的声明、宏和类型都留在同一个ASTContext中，每次输入只解析新增的文本
+ */
+class IncrementalParser {
+public:
+    IncrementalParser() : mCompiler(new CompilerInstance()), mParser(), mInputs(0) {
+        CompilerInstance &ci = *mCompiler;
+        ci.createDiagnostics();
+        //与命令行方式一样按C++解析，头文件在当前目录中查找
+        const char *args[] = { "-xc++", "-I.", "input.cc" };
+        CompilerInvocation::CreateFromArgs(ci.getInvocation(), std::begin(args), std::end(args),
+                                           ci.getDiagnostics());
+        ci.setTarget(TargetInfo::CreateTargetInfo(ci.getDiagnostics(), ci.getInvocation().TargetOpts));
+        ci.getTarget().adjust(ci.getLangOpts());
+        ci.createFileManager();
+        ci.createSourceManager(ci.getFileManager());
+        ci.createPreprocessor(TU_Complete);
+        ci.getPreprocessor().enableIncrementalProcessing();
+        ci.createASTContext();
+        ci.setASTConsumer(llvm::make_unique<ASTConsumer>());
+        ci.createSema(TU_Complete, nullptr);
+
+        //主文件是内建函数的声明，相当于每次会话开始时包含了sysfun.h
+        SourceManager &sm = ci.getSourceManager();
+        sm.setMainFileID(sm.createFileID(llvm::MemoryBuffer::getMemBufferCopy(kReplPrelude, "input.cc")));
+        ci.getDiagnosticClient().BeginSourceFile(ci.getLangOpts(), &ci.getPreprocessor());
+        mParser.reset(new Parser(ci.getPreprocessor(), ci.getSema(), false));
+        ci.getPreprocessor().EnterMainSourceFile();
+        mParser->Initialize();
+    }
+    ~IncrementalParser() {
+        mParser.reset();
+        mCompiler->getDiagnosticClient().EndSourceFile();
+    }
+
+    ASTContext &getASTContext() {
+        return mCompiler->getASTContext();
+    }
+
+    //解析主文件中内建函数的声明，只在会话开始时调用一次
+    bool parsePrelude(std::vector<Decl *> &decls) {
+        Parser::DeclGroupPtrTy group;
+        for (bool eof = mParser->ParseFirstTopLevelDecl(group); !eof; eof = mParser->ParseTopLevelDecl(group))
+            collect(group, decls);
+        return finish();
+    }
+
+    //解析一次输入，新的顶层声明依次放入decls，有错误时返回false，错误已经输出到标准错误
+    bool parse(const std::string &code, std::vector<Decl *> &decls) {
+        SourceManager &sm = mCompiler->getSourceManager();
+        std::string name = "input_line_" + std::to_string(++mInputs);
+        FileID fid = sm.createFileID(llvm::MemoryBuffer::getMemBufferCopy(code, name));
+        mCompiler->getPreprocessor().EnterSourceFile(fid, nullptr, SourceLocation());
+
+        //上次输入末尾的eof由ParseTopLevelDecl跳过，读到这次输入的eof时返回true
+        Parser::DeclGroupPtrTy group;
+        while (!mParser->ParseTopLevelDecl(group))
+            collect(group, decls);
+        return finish();
+    }
+
+    //name是否为已经声明的类型名，包括typedef、struct、union和enum
+    bool isTypeName(llvm::StringRef name) {
+        ASTContext &context = getASTContext();
+        DeclarationName decl_name(&context.Idents.get(name));
+        for (NamedDecl *decl : context.getTranslationUnitDecl()->lookup(decl_name))
+            if (isa<TypeDecl>(decl))
+                return true;
+        return false;
+    }
+
+private:
+    static void collect(Parser::DeclGroupPtrTy group, std::vector<Decl *> &decls) {
+        if (!group)
+            return ;
+        for (Decl *decl : group.get())
+            decls.push_back(decl);
+    }
+
+    //检查这次输入是否有错误，有错误时清除诊断状态，使之后的输入不受影响
+    bool finish() {
+        DiagnosticsEngine &diags = mCompiler->getDiagnostics();
+        if (!diags.hasErrorOccurred())
+            return true;
+        diags.Reset();
+        return false;
+    }
+
+    std::unique_ptr<CompilerInstance> mCompiler;
+    std::unique_ptr<Parser> mParser;
+    //已经解析的输入个数，用于命名内存文件和包装函数
+    unsigned mInputs;
+};
+
+/* 交互式执行：逐行读入，括号没有配对或者行末是反斜杠时继续读入下一行。每次输入按开头分为三种：
+ *   声明     以类型名、typedef、static等或者#开头，直接作为顶层声明解析，成为全局的变量、函数和类型
+ *   语句     以;或}结尾，包装在void __repl_N(void) { ... }中解析并立即执行
+ *   表达式   其它输入，包装在auto __repl_N(void) { return (...); }中执行，按返回类型显示它的值
+ * 表达式的值输出到标准输出，程序的print和诊断输出到标准错误。输入:quit或者读到文件末尾时结束
+ */
+class Repl {
+public:
+    Repl(IncrementalParser &parser, ReplBackend &backend, llvm::raw_ostream &out)
+    : mParser(parser), mBackend(backend), mOut(out), mEntries(0), mPrompt(isatty(STDIN_FILENO)) {}
+
+    void run(std::istream &in) {
+        std::vector<Decl *> decls;
+        bool ok = mParser.parsePrelude(decls);
+        for (Decl *decl : decls)
+            mBackend.declare(decl, ok);
+
+        std::string code;
+        while (read(in, code)) {
+            if (code == ":quit" || code == ":q")
+                break;
+            execute(code);
+            mOut.flush();
+        }
+    }
+
+private:
+    enum EntryKind {
+        ENTRY_DECL,
+        ENTRY_STMT,
+        ENTRY_EXPR
+    };
+
+    //读入一次输入，去掉首尾的空白，文件结束时返回false
+    bool read(std::istream &in, std::string &code) {
+        code.clear();
+        std::string line;
+        for (;;) {
+            prompt(code.empty() ? "> " : "... ");
+            if (!std::getline(in, line)) {
+                //文件末尾没有配对的输入照常解析，由clang报告错误
+                code = trim(code);
+                return !code.empty();
+            }
+            code += line;
+            code += '\n';
+            std::string text = stripComments(code);
+            if (trim(text).empty()) {   //空行和只有注释的行
+                code.clear();
+                continue;
+            }
+            std::string last = trim(line);
+            if (nesting(text) <= 0 && (last.empty() || last.back() != '\\'))
+                break;
+        }
+        code = trim(code);
+        return true;
+    }
+
+    void prompt(const char *text) {
+        if (mPrompt)
+            llvm::errs() << text;
+    }
+
+    void execute(const std::string &code) {
+        std::string text = trim(stripComments(code));
+        EntryKind kind = classify(text);
+        std::string source;
+        if (kind == ENTRY_DECL) {
+            //声明末尾的分号可以省略
+            source = code + "\n";
+            if (text[0] != '#' && text.back() != ';' && text.back() != '}')
+                source += ";\n";
+        }
+        else {
+            std::string name = "__repl_" + std::to_string(++mEntries);
+            if (kind == ENTRY_STMT)
+                source = "void " + name + "(void) {\n" + code + "\n}\n";
+            else
+                source = "auto " + name + "(void) {\nreturn (" + code + "\n);\n}\n";
+        }
+
+        std::vector<Decl *> decls;
+        bool ok = mParser.parse(source, decls);
+        for (Decl *decl : decls)
+            mBackend.declare(decl, ok);
+        if (!ok || kind == ENTRY_DECL || decls.empty())
+            return ;
+        FunctionDecl *entry = dyn_cast<FunctionDecl>(decls.back());
+        long val;
+        if (!entry || !mBackend.run(entry, val) || kind != ENTRY_EXPR)
+            return ;
+        show(entry->getReturnType(), val);
+    }
+
+    //按去掉注释后的第一个单词和最后一个字符区分输入的种类
+    EntryKind classify(const std::string &text) {
+        if (text[0] == '#')
+            return ENTRY_DECL;
+        size_t end = 0;
+        while (end < text.size() && (isalnum((unsigned char)text[end]) || text[end] == '_'))
+            ++end;
+        std::string word = text.substr(0, end);
+        static const char *const kDeclWords[] = {
+            "typedef", "extern", "static", "const", "volatile", "inline", "register", "auto",
+            "void", "char", "short", "int", "long", "float", "double", "signed", "unsigned",
+            "bool", "_Bool", "struct", "union", "enum"
+        };
+        for (const char *decl_word : kDeclWords)
+            if (word == decl_word)
+                return ENTRY_DECL;
+        if (!word.empty() && !isdigit((unsigned char)word[0]) && mParser.isTypeName(word))
+            return ENTRY_DECL;
+        return text.back() == ';' || text.back() == '}' ? ENTRY_STMT : ENTRY_EXPR;
+    }
+
+    //按静态类型显示表达式的值，void表达式不显示
+    void show(QualType type, long val) {
+        switch (valueKind(type)) {
+        case VK_VOID:
+        case VK_OTHER:
+            return ;
+        case VK_F32:
+        case VK_F64:
+            mOut << llvm::format("%.15g", Word<double>::get(val)) << "\n";
+            return ;
+        case VK_U8:
+        case VK_U16:
+        case VK_U32:
+        case VK_U64:
+            mOut << (unsigned long)val << "\n";
+            return ;
+        default:    //有符号整数、bool和指针
+            mOut << val << "\n";
+            return ;
+        }
+    }
+
+    //把注释换成空格，字符串和字符字面值中的内容不是注释
+    static std::string stripComments(const std::string &code) {
+        std::string text = code;
+        char quote = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (quote) {
+                if (text[i] == '\\')
+                    ++i;
+                else if (text[i] == quote)
+                    quote = 0;
+            }
+            else if (text[i] == '"' || text[i] == '\'')
+                quote = text[i];
+            else if (text.compare(i, 2, "//") == 0) {
+                for (; i < text.size() && text[i] != '\n'; ++i)
+                    text[i] = ' ';
+            }
+            else if (text.compare(i, 2, "/*") == 0) {
+                size_t end = text.find("*/", i + 2);
+                //注释还没有结束，当作未配对的括号继续读入
+                if (end == std::string::npos)
+                    return text.substr(0, i) + "(";
+                std::fill(text.begin() + i, text.begin() + end + 2, ' ');
+                i = end + 1;
+            }
+        }
+        return text;
+    }
+
+    //未配对的左括号个数，字符串和字符字面值中的括号不算
+    static int nesting(const std::string &text) {
+        int depth = 0;
+        char quote = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            if (quote) {
+                if (c == '\\')
+                    ++i;
+                else if (c == quote)
+                    quote = 0;
+            }
+            else if (c == '"' || c == '\'')
+                quote = c;
+            else if (c == '(' || c == '[' || c == '{')
+                ++depth;
+            else if (c == ')' || c == ']' || c == '}')
+                --depth;
+        }
+        return depth;
+    }
+
+    static std::string trim(const std::string &text) {
+        size_t begin = 0, end = text.size();
+        while (begin < end && isspace((unsigned char)text[begin]))
+            ++begin;
+        while (end > begin && isspace((unsigned char)text[end - 1]))
+            --end;
+        return text.substr(begin, end - begin);
+    }
+
+    IncrementalParser &mParser;
+    ReplBackend &mBackend;
+    //表达式的值
+    llvm::raw_ostream &mOut;
+    //已经执行的语句和表达式个数，用于命名包装函数
+    unsigned mEntries;
+    //标准输入是终端时才输出提示符
+    bool mPrompt;
+};
+
+#endif  // ~REPL_HPP
@@ -0,0 +1,247 @@
+#ifndef SERVE_HPP
+#define SERVE_HPP
+
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/PCHContainerOperations.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "io.hpp"
+#include "protocol.hpp"
+
+using namespace clang;
+
+//服务模式下程序的输入输出都经过客户端的连接
+class SocketIO : public ProgramIO {
+public:
+    explicit SocketIO(int fd)
+    : mFd(fd), mOutput(), mLastFlush(std::chrono::steady_clock::now()), mInput(), mPos(0),
+      mEof(false), mBroken(false) {}
+
+    //与命令行方式一样，先输出提示，再像std::cin >> val一样读入一个整数
+    virtual int read() {
+        message("Please input an integer: ");
+        int c;
+        while ((c = peek()) != EOF && isspace(c))
+            ++mPos;
+
+        bool negative = false;
+        if (c == '-' || c == '+') {
+            negative = c == '-';
+            ++mPos;
+        }
+        long val = 0;
+        while ((c = peek()) != EOF && isdigit(c)) {
+            val = val * 10 + (c - '0');
+            ++mPos;
+        }
+        return negative ? -val : val;
+    }
+
+    //输出先放在缓冲区中，缓冲区满了或者距上次发送超过20毫秒才发送
+    virtual void write(int val) {
+        mOutput += std::to_string(val);
+        mOutput += '\n';
+        if (mOutput.size() >= kChunk ||
+                std::chrono::steady_clock::now() - mLastFlush >= std::chrono::milliseconds(20))
+            flush();
+    }
+
+    virtual void flush() {
+        if (!mOutput.empty() && !mBroken)
+            mBroken = !writeFrame(mFd, FRAME_OUTPUT, mOutput);
+        mOutput.clear();
+        mLastFlush = std::chrono::steady_clock::now();
+    }
+
+    //发送诊断等文本，与程序的输出保持先后顺序
+    void message(const std::string &text) {
+        mOutput += text;
+    }
+
+private:
+    static const size_t kChunk = 4096;
+
+    int peek() {
+        if (mPos == mInput.size() && !fill())
+            return EOF;
+        return (unsigned char)mInput[mPos];
+    }
+
+    //向客户端请求更多输入，客户端回复空的I帧表示输入结束
+    bool fill() {
+        if (mEof || mBroken)
+            return false;
+        flush();
+        char tag;
+        if (!writeFrame(mFd, FRAME_READ, "") || !readFrame(mFd, tag, mInput) || tag != FRAME_INPUT) {
+            mBroken = true;
+            return false;
+        }
+        mPos = 0;
+        mEof = mInput.empty();
+        return !mEof;
+    }
+
+    int mFd;
+    std::string mOutput;
+    std::chrono::steady_clock::time_point mLastFlush;
+    std::string mInput;
+    size_t mPos;
+    bool mEof;
+    bool mBroken;
+};
+
+/* 常驻服务：在Unix域套接字上接收程序，每个程序在新的Environment中执行。
+ * 解析用的ASTUnit一直保留，每次只是把主文件换成新的源程序重新解析，
+ * 开头的#include "sysfun.h"等预处理部分编译成preamble，源程序的开头不变时直接复用。
+ * 请求按到达的顺序逐个处理
+ */
+class Server {
+public:
+    //在解析好的语法树上执行程序，args为客户端传来的选项，返回退出状态
+    typedef std::function<int(ASTUnit &unit, const std::vector<std::string> &args,
+                              ProgramIO &io, llvm::raw_ostream &err)> Runner;
+
+    Server(const std::string &path, Runner runner)
+    : mPath(path), mRunner(runner), mPCHOps(std::make_shared<PCHContainerOperations>()), mUnit() {}
+
+    //开始服务，只有出错时才返回
+    int run() {
+        if (!warmUp()) {
+            llvm::errs() << "serve: cannot create the parser\n";
+            return -1;
+        }
+
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (listener < 0 || mPath.size() >= sizeof(addr.sun_path)) {
+            llvm::errs() << "serve: cannot create socket " << mPath << "\n";
+            return -1;
+        }
+        strncpy(addr.sun_path, mPath.c_str(), sizeof(addr.sun_path) - 1);
+        unlink(mPath.c_str());
+        if (bind(listener, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 16) < 0) {
+            llvm::errs() << "serve: cannot listen on " << mPath << "\n";
+            close(listener);
+            return -1;
+        }
+        //客户端中途断开时不能让写操作终止整个服务
+        signal(SIGPIPE, SIG_IGN);
+        llvm::errs() << "serve: listening on " << mPath << "\n";
+
+        for (;;) {
+            int client = accept(listener, NULL, NULL);
+            if (client < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            handle(client);
+            close(client);
+        }
+        close(listener);
+        return -1;
+    }
+
+private:
+    //主文件的名字，与命令行方式相同
+    static const char *mainFile() {
+        return "input.cc";
+    }
+
+    //用一个只包含sysfun.h的程序完成第一次解析，同时生成preamble
+    bool warmUp() {
+        const char *args[] = { "clang-tool", "-fsyntax-only", mainFile() };
+        std::string source = "#include \"sysfun.h\"\nint main() { return 0; }\n";
+        ASTUnit::RemappedFile file(mainFile(),
+                                   llvm::MemoryBuffer::getMemBufferCopy(source, mainFile()).release());
+        IntrusiveRefCntPtr<DiagnosticsEngine> diags =
+                CompilerInstance::createDiagnostics(new DiagnosticOptions());
+        mUnit.reset(ASTUnit::LoadFromCommandLine(args, args + sizeof(args) / sizeof(args[0]), mPCHOps,
+                                                 diags, "", false, false, file, true, 1));
+        return mUnit != nullptr;
+    }
+
+    /* 重新解析新的源程序，诊断写到diag中，返回是否得到了语法树。与命令行方式相同，
+     * 只有可恢复的编译错误时仍然在恢复后的语法树上执行，例如按C++解析时int *p = malloc(...)会报错
+     */
+    bool parse(const std::string &source, llvm::raw_ostream &diag) {
+        DiagnosticsEngine &diags = mUnit->getDiagnostics();
+        diags.setClient(new TextDiagnosticPrinter(diag, &diags.getDiagnosticOptions()), true);
+        ASTUnit::RemappedFile file(mainFile(),
+                                   llvm::MemoryBuffer::getMemBufferCopy(source, mainFile()).release());
+        bool failed = mUnit->Reparse(mPCHOps, file);
+        diags.setClient(new IgnoringDiagConsumer(), true);
+        return !failed;
+    }
+
+    void handle(int fd) {
+        std::vector<std::string> args;
+        std::string source;
+        char tag;
+        std::string payload;
+        for (;;) {
+            if (!readFrame(fd, tag, payload))
+                return ;
+            if (tag == FRAME_ARG)
+                args.push_back(payload);
+            else if (tag == FRAME_SOURCE)
+                source = payload;
+            else if (tag == FRAME_PATH) {
+                std::ifstream source_file(payload);
+                if (!source_file) {
+                    writeFrame(fd, FRAME_OUTPUT, "cannot open " + payload + "\n");
+                    writeFrame(fd, FRAME_EXIT, "1");
+                    return ;
+                }
+                source.assign(std::istreambuf_iterator<char>{source_file},
+                              std::istreambuf_iterator<char>{});
+            }
+            else if (tag == FRAME_GO)
+                break;
+            else
+                return ;
+        }
+
+        SocketIO io(fd);
+        int status = 1;
+        std::string text;
+        llvm::raw_string_ostream os(text);
+        bool parsed = parse(source, os);
+        io.message(os.str());
+        text.clear();
+        if (parsed)
+            status = mRunner(*mUnit, args, io, os);
+        io.message(os.str());
+        io.flush();
+        writeFrame(fd, FRAME_EXIT, std::to_string(status));
+    }
+
+    std::string mPath;
+    Runner mRunner;
+    std::shared_ptr<PCHContainerOperations> mPCHOps;
+    std::unique_ptr<ASTUnit> mUnit;
+};
+
+#endif  // ~SERVE_HPP
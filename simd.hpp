@@ -0,0 +1,97 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "clang/AST/OperationKinds.h"
+
+using namespace clang;
+
+/* int数组的批量操作，用于识别出的循环惯用法。堆单元是long，int元素符号扩展后存放，
+ * 所以运算在64位上进行后再把低32位符号扩展，结果与逐个元素按int回绕相同。
+ * x86-64上用SSE2每次处理两个单元，其它平台用普通循环
+ */
+
+//把低32位符号扩展为long
+static inline long sext32(unsigned long val) {
+    return (long)(int)(unsigned)val;
+}
+
+#ifdef __SSE2__
+//两个64位单元各自取低32位符号扩展
+static inline __m128i sext32(__m128i val) {
+    __m128i low = _mm_shuffle_epi32(val, _MM_SHUFFLE(3, 3, 2, 0));
+    return _mm_unpacklo_epi32(low, _mm_srai_epi32(low, 31));
+}
+#endif
+
+//dst[k] = val
+static void bulkFill(long *dst, long count, long val) {
+    long k = 0;
+#ifdef __SSE2__
+    __m128i v = _mm_set1_epi64x(val);
+    for (; k + 2 <= count; k += 2)
+        _mm_storeu_si128((__m128i *)(dst + k), v);
+#endif
+    for (; k < count; ++k)
+        dst[k] = val;
+}
+
+//dst[k] = src[k]，两段内存相同或者不重叠
+static void bulkCopy(long *dst, const long *src, long count) {
+    if (dst != src)
+        memcpy(dst, src, count * sizeof(long));
+}
+
+/* dst[k] = x[k] op y[k]，op为+、-或*，x或y为NULL时以常量xval或yval代替。
+ * dst与x、y相同或者不重叠
+ */
+static void bulkBinary(BinaryOperatorKind op, long *dst, const long *x, long xval,
+                       const long *y, long yval, long count) {
+    long k = 0;
+#ifdef __SSE2__
+    __m128i xs = _mm_set1_epi64x(xval);
+    __m128i ys = _mm_set1_epi64x(yval);
+    for (; k + 2 <= count; k += 2) {
+        __m128i a = x ? _mm_loadu_si128((const __m128i *)(x + k)) : xs;
+        __m128i b = y ? _mm_loadu_si128((const __m128i *)(y + k)) : ys;
+        __m128i r;
+        if (op == BO_Add)
+            r = _mm_add_epi64(a, b);
+        else if (op == BO_Sub)
+            r = _mm_sub_epi64(a, b);
+        else    //乘积的低32位只取决于两个因数的低32位
+            r = _mm_mul_epu32(a, b);
+        _mm_storeu_si128((__m128i *)(dst + k), sext32(r));
+    }
+#endif
+    for (; k < count; ++k) {
+        unsigned long a = x ? x[k] : xval;
+        unsigned long b = y ? y[k] : yval;
+        dst[k] = sext32(op == BO_Add ? a + b : op == BO_Sub ? a - b : a * b);
+    }
+}
+
+//init + x[0] + ... + x[count - 1]，按int回绕
+static long bulkSum(const long *x, long count, long init) {
+    unsigned long sum = init;
+    long k = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (; k + 2 <= count; k += 2)
+        acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i *)(x + k)));
+    unsigned long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, acc);
+    sum += lanes[0] + lanes[1];
+#endif
+    for (; k < count; ++k)
+        sum += x[k];
+    return sext32(sum);
+}
+
+#endif  // ~SIMD_HPP
@@ -0,0 +1,42 @@
+#include "sysfun.h"
+
+int find(int n) {
+    int i;
+    for (i = 2; i < n; i++) {
+        if (n % i == 0)
+            return i;
+    }
+    return n;
+}
+
+int main() {
+    int i = 0, sum = 0;
+    while (1) {
+        i = i + 1;
+        if (i > 10)
+            break;
+        if (i % 2 == 0)
+            continue;
+        sum = sum + i;
+    }
+    print(sum);
+
+    int j;
+    for (j = 0; j < 10; j++) {
+        if (j == 3)
+            continue;
+        if (j == 6)
+            break;
+        print(j);
+    }
+
+    do {
+        j = j - 1;
+        if (j == 2)
+            continue;
+        print(j);
+    } while (j > 0);
+
+    print(find(91));
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "sysfun.h"
+
+long fact(int n) {
+    long r = 1;
+    int i;
+    for (i = 2; i <= n; i++)
+        r *= i;
+    return r;
+}
+
+double average(int *a, int n) {
+    double sum = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += a[i];
+    return sum / n;
+}
+
+int main() {
+    long f = fact(20);
+    print(f / 1000000000000L);
+    print(f % 1000000);
+
+    char c = 120;
+    c += 10;
+    print(c);
+    unsigned u = 0;
+    u = u - 1;
+    print(u > 100);
+    print(u / 2 > 2000000000);
+
+    int a[4];
+    a[0] = 1;
+    a[1] = 2;
+    a[2] = 3;
+    a[3] = 5;
+    double avg = average(a, 4);
+    print(avg * 100);
+    double x = 1.5;
+    x = -x * 3;
+    print(x);
+    print(x < -4.25);
+
+    int bits = 1 << 20 | 5;
+    print(bits ^ 4);
+    print(~bits & 255);
+
+    //int运算按int回绕，之后再扩展为long
+    int big = 2147483647;
+    long wrapped = big + 1;
+    print(wrapped < 0);
+    long widened = (long)big + 1;
+    print(widened > 0);
+    int low = -big - 1;
+    long negated = -low;
+    print(negated < 0);
+    int one = 1;
+    long shifted = one << 31;
+    print(shifted < 0);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include "sysfun.h"
+
+int total(int *a, int n) {
+    int s = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        s = s + a[i];
+    return s;
+}
+
+int main() {
+    int n = 1000;
+    int a[1000];
+    int b[1000];
+    int *c = (int *)malloc(n * sizeof(int));
+    int i;
+
+    for (i = 0; i < n; i++)
+        a[i] = 3;
+    for (i = 0; i < n; i++)
+        b[i] = a[i] * 2147483647;
+    print(b[0]);
+    for (i = 0; i < n; i = i + 1)
+        c[i] = a[i] + b[i];
+    print(c[999]);
+    print(total(c, n));
+    print(i);
+
+    for (i = 0; i < n; i++)
+        a[i] = i;
+    for (i = 10; i <= 20; i++)
+        c[i] = 100 - a[i];
+    print(c[10] + c[20]);
+    print(c[21]);
+
+    int s = 7;
+    for (i = 0; i < n; i++) {
+        s += a[i];
+    }
+    print(s);
+
+    int *d = a + 1;
+    for (i = 0; i < 10; i++)
+        d[i] = a[i];
+    print(a[10]);
+
+    for (i = 5; i < 3; i++)
+        a[i] = 0;
+    print(i);
+    free(c);
+    return 0;
+}
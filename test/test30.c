@@ -0,0 +1,50 @@
+#include "sysfun.h"
+
+//每层递归都有自己的局部数组，返回后释放
+int depth(int n) {
+    int buf[100];
+    int i;
+    for (i = 0; i < 100; i++)
+        buf[i] = n;
+    if (n == 0)
+        return buf[99];
+    return depth(n - 1) + buf[0];
+}
+
+void fill(int *p, int v) {
+    *p = v;
+}
+
+//被取地址的变量和数组都在栈内存中，不能作为尾调用
+int through(int n, int acc) {
+    int x;
+    fill(&x, n);
+    if (n == 0)
+        return acc;
+    return through(n - 1, acc + x);
+}
+
+int sum(int *a, int n) {
+    int s = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        s = s + a[i];
+    return s;
+}
+
+int main() {
+    int k;
+    int i;
+    int total = 0;
+    //循环体内的数组每轮使用同一块栈内存
+    for (k = 0; k < 20000; k++) {
+        int tmp[50];
+        for (i = 0; i < 50; i++)
+            tmp[i] = k + i;
+        total = total + sum(tmp, 50) % 7;
+    }
+    print(total);
+    print(depth(1000));
+    print(through(100, 0));
+    return 0;
+}
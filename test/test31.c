@@ -0,0 +1,22 @@
+#include "sysfun.h"
+
+//用--heap-report运行：第一个循环的块都已释放，第二个循环留下5个块没有释放
+int main() {
+    int *p;
+    int i;
+    int s = 0;
+    for (i = 0; i < 10; i++) {
+        p = malloc(sizeof(int) * (i + 1));
+        p[i] = i;
+        s = s + p[i];
+        free(p);
+    }
+    for (i = 0; i < 10; i++) {
+        p = malloc(sizeof(int) * 4);
+        p[0] = i;
+        s = s + p[0];
+        if (i % 2 == 0)
+            free(p);
+    }
+    print(s);
+}
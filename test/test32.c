@@ -0,0 +1,20 @@
+#include "sysfun.h"
+
+//被取地址的全局变量在内存中，两种执行方式都从初始值开始
+int g = 5;
+int h = 9;
+
+void bump(int *q) {
+    *q = *q + 1;
+}
+
+int main() {
+    int *p = &g;
+    print(*p);
+    print(g);
+    *p = 7;
+    print(g);
+    bump(&h);
+    print(h);
+    return 0;
+}
@@ -0,0 +1,16 @@
+#include "sysfun.h"
+
+//sizeof按解释器的大小计算，化简、遍历执行和字节码的结果相同
+int main() {
+    int n = 3;
+    long *a = (long *)malloc(n * sizeof(long));
+    int i;
+    for (i = 0; i < n; i = i + 1)
+        a[i] = i * 10;
+    print(sizeof(long));
+    print(2 * sizeof(long) + 1);
+    print(n * sizeof(char));
+    print(a[n - 1]);
+    free(a);
+    return 0;
+}
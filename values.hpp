@@ -0,0 +1,397 @@
+#ifndef VALUES_HPP
+#define VALUES_HPP
+
+#include <cstring>
+#include <type_traits>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/OperationKinds.h"
+#include "clang/AST/Type.h"
+
+using namespace clang;
+
+/* 值的表示：操作数栈、变量和堆单元中的每个值都是一个64位的字。整数按它的类型截断后
+ * 符号扩展或零扩展到64位，指针是堆单元的编号，float和double都以double的位模式保存。
+ * 字本身不带类型标记，类型在执行前由clang的QualType确定：每个表达式第一次求值时按
+ * 操作数的类型选好对应的运算函数，之后每次求值直接调用，运算时不再判断类型
+ */
+enum ValueKind {
+    VK_VOID,
+    VK_BOOL,
+    VK_I8,
+    VK_U8,
+    VK_I16,
+    VK_U16,
+    VK_I32,
+    VK_U32,
+    VK_I64,
+    VK_U64,
+    VK_F32,
+    VK_F64,
+    VK_PTR,         //指针、数组和函数
+    VK_OTHER        //结构体等不支持的类型
+};
+
+static ValueKind valueKind(QualType type) {
+    type = type.getCanonicalType();
+    if (type->isPointerType() || type->isArrayType() || type->isFunctionType())
+        return VK_PTR;
+    if (const EnumType *enum_type = type->getAs<EnumType>())
+        return valueKind(enum_type->getDecl()->getIntegerType());
+    const BuiltinType *builtin = type->getAs<BuiltinType>();
+    if (!builtin)
+        return VK_OTHER;
+    switch (builtin->getKind()) {
+    case BuiltinType::Void:         return VK_VOID;
+    case BuiltinType::Bool:         return VK_BOOL;
+    case BuiltinType::Char_S:
+    case BuiltinType::SChar:        return VK_I8;
+    case BuiltinType::Char_U:
+    case BuiltinType::UChar:        return VK_U8;
+    case BuiltinType::Short:        return VK_I16;
+    case BuiltinType::UShort:       return VK_U16;
+    case BuiltinType::Int:          return VK_I32;
+    case BuiltinType::UInt:         return VK_U32;
+    case BuiltinType::Long:
+    case BuiltinType::LongLong:     return VK_I64;
+    case BuiltinType::ULong:
+    case BuiltinType::ULongLong:    return VK_U64;
+    case BuiltinType::Float:        return VK_F32;
+    case BuiltinType::Double:
+    case BuiltinType::LongDouble:   return VK_F64;     //long double按double计算
+    default:                        return VK_OTHER;
+    }
+}
+
+/* 解释器里sizeof的值：整数和浮点数都占一个堆单元，按int计算，与malloc按int计算单元数
+ * 一致；指针按int *计算，其余类型为0。遍历执行、字节码和常量折叠都用这个值，
+ * 不能用ASTContext按目标平台算出的大小，否则sizeof(long)等在不同执行方式下结果不同
+ */
+static int sizeOfType(QualType type) {
+    if (type->isIntegerType() || type->isRealFloatingType())
+        return sizeof(int);
+    if (type->isPointerType())
+        return sizeof(int *);
+    return 0;
+}
+
+//C类型与64位字之间的转换
+template <typename T>
+struct Word {
+    static T get(long word) {
+        return (T)word;
+    }
+    static long make(T val) {
+        return (long)val;
+    }
+};
+
+template <>
+struct Word<double> {
+    static double get(long word) {
+        double val;
+        memcpy(&val, &word, sizeof(val));
+        return val;
+    }
+    static long make(double val) {
+        long word;
+        memcpy(&word, &val, sizeof(word));
+        return word;
+    }
+};
+
+template <>
+struct Word<float> {
+    static float get(long word) {
+        return (float)Word<double>::get(word);
+    }
+    static long make(float val) {
+        return Word<double>::make(val);
+    }
+};
+
+//整数的加减乘和取负按无符号数计算，溢出时与C一样回绕，不触发有符号溢出的未定义行为
+template <typename T, bool = std::is_integral<T>::value>
+struct Arith {
+    static T add(T x, T y) { return (T)((unsigned long)x + (unsigned long)y); }
+    static T sub(T x, T y) { return (T)((unsigned long)x - (unsigned long)y); }
+    static T mul(T x, T y) { return (T)((unsigned long)x * (unsigned long)y); }
+    static T neg(T x) { return (T)(0UL - (unsigned long)x); }
+};
+
+template <typename T>
+struct Arith<T, false> {
+    static T add(T x, T y) { return x + y; }
+    static T sub(T x, T y) { return x - y; }
+    static T mul(T x, T y) { return x * y; }
+    static T neg(T x) { return -x; }
+};
+
+typedef long (*BinaryKernel)(long lhs, long rhs);
+typedef long (*UnaryKernel)(long val);
+
+//所有算术类型都有的二元运算，比较和逻辑运算的结果是int
+template <typename T, BinaryOperatorKind Op>
+static long arithKernel(long lhs, long rhs) {
+    T x = Word<T>::get(lhs);
+    T y = Word<T>::get(rhs);
+    switch (Op) {
+    case BO_Add:  return Word<T>::make(Arith<T>::add(x, y));
+    case BO_Sub:  return Word<T>::make(Arith<T>::sub(x, y));
+    case BO_Mul:  return Word<T>::make(Arith<T>::mul(x, y));
+    case BO_Div:  return Word<T>::make(x / y);
+    case BO_LT:   return x < y;
+    case BO_GT:   return x > y;
+    case BO_LE:   return x <= y;
+    case BO_GE:   return x >= y;
+    case BO_EQ:   return x == y;
+    case BO_NE:   return x != y;
+    case BO_LAnd: return x && y;
+    case BO_LOr:  return x || y;
+    default:      return rhs;      //逗号表达式
+    }
+}
+
+//只有整数才有的二元运算，移位的右操作数可以是另一种整数类型
+template <typename T, BinaryOperatorKind Op>
+static long integerKernel(long lhs, long rhs) {
+    typedef typename std::make_unsigned<T>::type U;
+    T x = Word<T>::get(lhs);
+    switch (Op) {
+    case BO_Rem:  return Word<T>::make(x % Word<T>::get(rhs));
+    case BO_And:  return Word<T>::make(x & Word<T>::get(rhs));
+    case BO_Or:   return Word<T>::make(x | Word<T>::get(rhs));
+    case BO_Xor:  return Word<T>::make(x ^ Word<T>::get(rhs));
+    case BO_Shl:  return Word<T>::make((T)((U)x << rhs));
+    default:      return Word<T>::make(x >> rhs);
+    }
+}
+
+template <typename T>
+static BinaryKernel arithKernelFor(BinaryOperatorKind op) {
+    switch (op) {
+    case BO_Add:   return arithKernel<T, BO_Add>;
+    case BO_Sub:   return arithKernel<T, BO_Sub>;
+    case BO_Mul:   return arithKernel<T, BO_Mul>;
+    case BO_Div:   return arithKernel<T, BO_Div>;
+    case BO_LT:    return arithKernel<T, BO_LT>;
+    case BO_GT:    return arithKernel<T, BO_GT>;
+    case BO_LE:    return arithKernel<T, BO_LE>;
+    case BO_GE:    return arithKernel<T, BO_GE>;
+    case BO_EQ:    return arithKernel<T, BO_EQ>;
+    case BO_NE:    return arithKernel<T, BO_NE>;
+    case BO_LAnd:  return arithKernel<T, BO_LAnd>;
+    case BO_LOr:   return arithKernel<T, BO_LOr>;
+    case BO_Comma: return arithKernel<T, BO_Comma>;
+    default:       return NULL;
+    }
+}
+
+template <typename T>
+static BinaryKernel integerKernelFor(BinaryOperatorKind op) {
+    switch (op) {
+    case BO_Rem: return integerKernel<T, BO_Rem>;
+    case BO_And: return integerKernel<T, BO_And>;
+    case BO_Or:  return integerKernel<T, BO_Or>;
+    case BO_Xor: return integerKernel<T, BO_Xor>;
+    case BO_Shl: return integerKernel<T, BO_Shl>;
+    case BO_Shr: return integerKernel<T, BO_Shr>;
+    default:     return arithKernelFor<T>(op);
+    }
+}
+
+/* 按操作数的类型选择二元运算，指针运算以堆单元为单位，按long计算。
+ * 整数提升之后操作数至少是int，不支持的组合返回NULL
+ */
+static BinaryKernel binaryKernel(BinaryOperatorKind op, ValueKind kind) {
+    switch (kind) {
+    case VK_BOOL:
+    case VK_I8:
+    case VK_I16:
+    case VK_I32: return integerKernelFor<int>(op);
+    case VK_U8:
+    case VK_U16:
+    case VK_U32: return integerKernelFor<unsigned>(op);
+    case VK_I64:
+    case VK_PTR: return integerKernelFor<long>(op);
+    case VK_U64: return integerKernelFor<unsigned long>(op);
+    case VK_F32: return arithKernelFor<float>(op);
+    case VK_F64: return arithKernelFor<double>(op);
+    default:     return NULL;
+    }
+}
+
+//一元运算：取负、按位取反、逻辑非和自增自减
+template <typename T, UnaryOperatorKind Op>
+static long unaryArith(long val) {
+    T x = Word<T>::get(val);
+    switch (Op) {
+    case UO_Minus:  return Word<T>::make(Arith<T>::neg(x));
+    case UO_LNot:   return !x;
+    case UO_PreInc: return Word<T>::make(Arith<T>::add(x, (T)1));
+    default:        return Word<T>::make(Arith<T>::sub(x, (T)1));
+    }
+}
+
+template <typename T>
+static long bitNotKernel(long val) {
+    return Word<T>::make(~Word<T>::get(val));
+}
+
+template <typename T>
+static UnaryKernel unaryKernelFor(UnaryOperatorKind op) {
+    switch (op) {
+    case UO_Minus:   return unaryArith<T, UO_Minus>;
+    case UO_LNot:    return unaryArith<T, UO_LNot>;
+    case UO_PreInc:
+    case UO_PostInc: return unaryArith<T, UO_PreInc>;
+    case UO_PreDec:
+    case UO_PostDec: return unaryArith<T, UO_PreDec>;
+    default:         return NULL;
+    }
+}
+
+template <typename T>
+static UnaryKernel integerUnaryKernelFor(UnaryOperatorKind op) {
+    if (op == UO_Not)
+        return bitNotKernel<T>;
+    return unaryKernelFor<T>(op);
+}
+
+//按操作数的类型选择一元运算，自增自减的操作数可以是char等窄类型，结果按原类型回绕
+static UnaryKernel unaryKernel(UnaryOperatorKind op, ValueKind kind) {
+    switch (kind) {
+    case VK_BOOL:
+    case VK_I32: return integerUnaryKernelFor<int>(op);
+    case VK_I8:  return integerUnaryKernelFor<signed char>(op);
+    case VK_U8:  return integerUnaryKernelFor<unsigned char>(op);
+    case VK_I16: return integerUnaryKernelFor<short>(op);
+    case VK_U16: return integerUnaryKernelFor<unsigned short>(op);
+    case VK_U32: return integerUnaryKernelFor<unsigned>(op);
+    case VK_I64:
+    case VK_PTR: return integerUnaryKernelFor<long>(op);
+    case VK_U64: return integerUnaryKernelFor<unsigned long>(op);
+    case VK_F32: return unaryKernelFor<float>(op);
+    case VK_F64: return unaryKernelFor<double>(op);
+    default:     return NULL;
+    }
+}
+
+//类型转换，转换为bool时非零为1
+template <typename From, typename To>
+static long convertWord(long word) {
+    return Word<To>::make((To)Word<From>::get(word));
+}
+
+template <typename From>
+static UnaryKernel convertKernelFrom(ValueKind to) {
+    switch (to) {
+    case VK_BOOL: return convertWord<From, bool>;
+    case VK_I8:   return convertWord<From, signed char>;
+    case VK_U8:   return convertWord<From, unsigned char>;
+    case VK_I16:  return convertWord<From, short>;
+    case VK_U16:  return convertWord<From, unsigned short>;
+    case VK_I32:  return convertWord<From, int>;
+    case VK_U32:  return convertWord<From, unsigned>;
+    case VK_I64:
+    case VK_PTR:  return convertWord<From, long>;
+    case VK_U64:  return convertWord<From, unsigned long>;
+    case VK_F32:  return convertWord<From, float>;
+    case VK_F64:  return convertWord<From, double>;
+    default:      return NULL;
+    }
+}
+
+//从from类型转换到to类型，值不变时返回NULL
+static UnaryKernel convertKernel(ValueKind from, ValueKind to) {
+    if (from == to || to == VK_VOID)
+        return NULL;
+    switch (from) {
+    case VK_BOOL: return convertKernelFrom<bool>(to);
+    case VK_I8:   return convertKernelFrom<signed char>(to);
+    case VK_U8:   return convertKernelFrom<unsigned char>(to);
+    case VK_I16:  return convertKernelFrom<short>(to);
+    case VK_U16:  return convertKernelFrom<unsigned short>(to);
+    case VK_I32:  return convertKernelFrom<int>(to);
+    case VK_U32:  return convertKernelFrom<unsigned>(to);
+    case VK_I64:
+    case VK_PTR:  return convertKernelFrom<long>(to);
+    case VK_U64:  return convertKernelFrom<unsigned long>(to);
+    case VK_F32:  return convertKernelFrom<float>(to);
+    case VK_F64:  return convertKernelFrom<double>(to);
+    default:      return NULL;
+    }
+}
+
+//会改变值的类型转换，其它转换(左值到右值、数组到指针等)不改变值
+static bool isValueCast(CastKind kind) {
+    switch (kind) {
+    case CK_IntegralCast:
+    case CK_IntegralToBoolean:
+    case CK_IntegralToFloating:
+    case CK_FloatingToIntegral:
+    case CK_FloatingToBoolean:
+    case CK_FloatingCast:
+    case CK_PointerToIntegral:
+    case CK_PointerToBoolean:
+    case CK_IntegralToPointer:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//为一个表达式选好的运算，没有用到的为NULL
+struct ExprKernels {
+    BinaryKernel binary;    //二元运算
+    UnaryKernel unary;      //一元运算或者类型转换，类型转换为NULL时值不变
+    UnaryKernel widen;      //复合赋值：左边原来的值转换为计算类型
+    UnaryKernel narrow;     //复合赋值：结果转换回左边的类型
+};
+
+//按表达式及其操作数的静态类型选择运算
+static ExprKernels selectKernels(const Expr *expr) {
+    ExprKernels kernels = { NULL, NULL, NULL, NULL };
+    if (const CompoundAssignOperator *assign = dyn_cast<CompoundAssignOperator>(expr)) {
+        ValueKind target = valueKind(assign->getLHS()->getType());
+        ValueKind computation = valueKind(assign->getComputationLHSType());
+        BinaryOperatorKind op = BinaryOperator::getOpForCompoundAssignment(assign->getOpcode());
+        kernels.widen = convertKernel(target, computation);
+        kernels.binary = binaryKernel(op, computation);
+        kernels.narrow = convertKernel(valueKind(assign->getComputationResultType()), target);
+    }
+    else if (const BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+        //整数加指针时按指针计算，其它运算按左操作数(已经过通常算术转换)的类型计算
+        ValueKind kind = valueKind(bop->getLHS()->getType());
+        if (bop->isAdditiveOp() && bop->getType()->isPointerType())
+            kind = VK_PTR;
+        kernels.binary = binaryKernel(bop->getOpcode(), kind);
+    }
+    else if (const UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+        kernels.unary = unaryKernel(uop->getOpcode(), valueKind(uop->getSubExpr()->getType()));
+    else if (const CastExpr *castexpr = dyn_cast<CastExpr>(expr)) {
+        if (isValueCast(castexpr->getCastKind()))
+            kernels.unary = convertKernel(valueKind(castexpr->getSubExpr()->getType()), valueKind(castexpr->getType()));
+    }
+    return kernels;
+}
+
+//常量表达式的值，用于全局变量的初始值，不是常量时为0
+static long constantWord(const ASTContext &context, const Expr *expr) {
+    Expr::EvalResult result;
+    if (!expr->EvaluateAsRValue(result, context))
+        return 0;
+    const APValue &val = result.Val;
+    if (val.isInt())
+        return val.getInt().getExtValue();
+    if (val.isFloat()) {
+        bool lost;
+        llvm::APFloat num = val.getFloat();
+        num.convert(llvm::APFloat::IEEEdouble(), llvm::APFloat::rmNearestTiesToEven, &lost);
+        return Word<double>::make(num.convertToDouble());
+    }
+    return 0;
+}
+
+#endif  // ~VALUES_HPP